@@ -0,0 +1,56 @@
+//========================================================================
+// FILE:
+//    CallGraphCSR.h
+//
+// DESCRIPTION:
+//    Compressed sparse row (CSR) representation of a call graph. Nodes are
+//    numbered 0..NumNodes-1. Both the forward (caller -> callee) and the
+//    reverse (callee -> caller) adjacency are stored, so that memory is
+//    O(V+E) rather than the O(V^2) of a dense adjacency matrix.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_CALLGRAPHCSR_H
+#define LLVM_TUTOR_CALLGRAPHCSR_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include <utility>
+#include <vector>
+
+struct CallGraphCSR {
+  using Edge = std::pair<int, int>;
+
+  CallGraphCSR() = default;
+  // Builds the graph from a list of (caller, callee) edges. Duplicate edges
+  // are collapsed. Edges is taken by value since it is sorted in place.
+  CallGraphCSR(int NumNodes, std::vector<Edge> Edges);
+
+  int numNodes() const { return NumNodes; }
+  int numEdges() const { return static_cast<int>(Targets.size()); }
+
+  // Callees of U.
+  llvm::ArrayRef<int> succs(int U) const {
+    return llvm::makeArrayRef(Targets.data() + Offsets[U],
+                              Targets.data() + Offsets[U + 1]);
+  }
+  // Callers of V.
+  llvm::ArrayRef<int> preds(int V) const {
+    return llvm::makeArrayRef(RTargets.data() + ROffsets[V],
+                              RTargets.data() + ROffsets[V + 1]);
+  }
+
+  // Computes the strongly connected components (Tarjan, iterative). SCCOf[N]
+  // is set to the SCC of node N. SCCs are numbered in reverse topological
+  // order: callees before callers, so SCC 0 has no callee outside itself.
+  // Returns the number of SCCs.
+  int computeSCCs(std::vector<int> &SCCOf) const;
+
+private:
+  int NumNodes = 0;
+  std::vector<int> Offsets;
+  std::vector<int> Targets;
+  std::vector<int> ROffsets;
+  std::vector<int> RTargets;
+};
+
+#endif // LLVM_TUTOR_CALLGRAPHCSR_H
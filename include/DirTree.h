@@ -0,0 +1,96 @@
+//========================================================================
+// FILE:
+//    DirTree.h
+//
+// DESCRIPTION:
+//    Declares DirTree, a trie of the source directories of the MMIO
+//    functions. A node is a directory; its children are looked up by
+//    (parent, interned component), so finding a directory costs one hash
+//    lookup per path component and allocates nothing once the directory
+//    is known. Absolute paths are under a "/" node and relative paths
+//    directly under the root, which is no directory itself; functions
+//    without a directory (no debug info) share a node of their own. Used by
+//    the HAL directory rule (see
+//    FindHALBypass::applyHalDirRule), which marks directories or whole
+//    subtrees as HAL and rolls statistics up the tree.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_DIRTREE_H
+#define LLVM_TUTOR_DIRTREE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+class DirTree {
+public:
+  // Statistics of the MMIO functions of a directory; of a subtree after
+  // rollUp.
+  struct Stats {
+    unsigned NumFuncs = 0;
+    // With at least -hal-tc-threshold transitive callers.
+    unsigned NumOverThreshold = 0;
+    unsigned NumNCMA_CG = 0;
+    int MaxTC = 0;
+  };
+
+  DirTree();
+  DirTree(const DirTree &) = delete;
+  DirTree &operator=(const DirTree &) = delete;
+
+  // Node of directory Dir, adding it and its ancestors if needed; "" is
+  // getNoDir().
+  unsigned insert(llvm::StringRef Dir);
+
+  // Parent of "/", of the top relative directories and of getNoDir().
+  static unsigned getRoot() { return 0; }
+  // Node of the functions without a directory, printed as "<none>".
+  static unsigned getNoDir() { return 1; }
+  unsigned getParent(unsigned N) const { return Nodes[N].Parent; }
+  unsigned getDepth(unsigned N) const { return Nodes[N].Depth; }
+  unsigned size() const { return static_cast<unsigned>(Nodes.size()); }
+  std::string getPath(unsigned N) const;
+
+  // Deepest common ancestor of A and B.
+  unsigned getCommonAncestor(unsigned A, unsigned B) const;
+  // Ancestor of N at Depth, N itself if it is not deeper.
+  unsigned getAncestor(unsigned N, unsigned Depth) const;
+
+  // Marks directory N, or with Subtree, N and all its descendants, as HAL.
+  void markHal(unsigned N, bool Subtree);
+  // Whether N is a HAL directory, in O(depth of N).
+  bool isHal(unsigned N) const;
+
+  Stats &getStats(unsigned N) { return Nodes[N].S; }
+  // Adds the statistics of every directory to those of its ancestors, in
+  // one pass. Call once.
+  void rollUp();
+  // One line per subtree with MMIO functions, sorted by path; the root is
+  // left out.
+  void writeRollup(llvm::raw_ostream &OS) const;
+
+private:
+  enum class Mark : unsigned char { None, Dir, Subtree };
+  struct Node {
+    unsigned Parent;
+    unsigned Depth;
+    llvm::StringRef Name;
+    Mark HalMark;
+    Stats S;
+  };
+
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Saver;
+  // Parents come before their children.
+  std::vector<Node> Nodes;
+  // Keys point into Alloc.
+  llvm::DenseMap<std::pair<unsigned, llvm::StringRef>, unsigned> Children;
+};
+
+#endif // LLVM_TUTOR_DIRTREE_H
@@ -13,15 +13,24 @@
 #ifndef LLVM_TUTOR_FINDHALBYPASS_H_H
 #define LLVM_TUTOR_FINDHALBYPASS_H_H
 
+#include "CallGraphCSR.h"
+#include "DirTree.h"
 #include "FindMMIOFunc.h"
+#include "FlatCallGraph.h"
+#include "PathTable.h"
 
 //#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/AbstractCallSite.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSummaryIndex.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Analysis/CallGraph.h"
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 //------------------------------------------------------------------------------
@@ -29,11 +38,78 @@
 //------------------------------------------------------------------------------
 //using ResultStaticCC = llvm::MapVector<const llvm::Function *, unsigned>;
 
+// How the passes of the estimator are computed:
+//  * BFS: one rank-ordered BFS per pass
+//  * Sketch: up to 64 passes at once, as lanes of least ranks propagated
+//    over the SCC condensation
+enum class TCEstBackend { BFS, Sketch };
+
+// -hal-tc-est-threads, set by tools that already run analyses in parallel
+// (see halvd).
+extern llvm::cl::opt<unsigned> TCEstThreads;
+// -hal-analysis-time, turned off by tools that print their own reports
+// (see halvd).
+extern llvm::cl::opt<bool> HalAnalysisTime;
+
+// Parameters of the randomized transitive closure in-degree estimator
+// (FindHALBypass::runTCEst).
+struct TCEstOptions {
+  TCEstBackend Backend = TCEstBackend::BFS;
+  // Number of passes; with Adaptive, the number of passes per batch.
+  unsigned NumIter = 10;
+  // The ranks of a pass are a function of (Seed, pass index, node) only, so
+  // results are reproducible whatever the number of threads.
+  uint64_t Seed = 0;
+  // 0 = one thread per hardware thread.
+  unsigned NumThreads = 0;
+  // Keep adding batches of passes, up to MaxIter passes in total, while the
+  // 95% confidence interval of some Queries node straddles Threshold.
+  bool Adaptive = false;
+  unsigned MaxIter = 320;
+  int Threshold = 10;
+  llvm::ArrayRef<int> Queries;
+};
+
+// An MMIO function as printed in a report. It does not refer to the IR, so
+// it can outlive the module (see UnionCallGraph).
+struct HALBypassReportEntry {
+  std::string Name;
+  // Debug location of the MMIO instruction as printed, "" without one, and
+  // its parts (File is "" and Line 0 without one).
+  std::string Loc;
+  std::string File;
+  unsigned Line;
+  unsigned Col;
+  int TransClosureInDeg;
+  bool NCMA_CG;
+  bool NCMA_GroundTruth;
+  bool MacroUsed;
+  // MMIO instructions of the function and the range of their addresses.
+  unsigned NumSites;
+  uint64_t MinAddr;
+  uint64_t MaxAddr;
+  // With -hal-svd, the peripheral and register at the address of the MMIO
+  // instruction ("" for none).
+  std::string Peripheral;
+  std::string Register;
+  // With -hal-svd, the number of MMIO instructions of the function at each
+  // peripheral and register they access ("" for none), sorted by name.
+  struct Access {
+    std::string Peripheral;
+    std::string Register;
+    unsigned Count;
+  };
+  std::vector<Access> Accesses;
+};
+
 struct FindHALBypass : public llvm::AnalysisInfoMixin<FindHALBypass> {
   struct MMIOFunc : public FindMMIOFunc::MMIOFunc {
-    MMIOFunc(const FindMMIOFunc::MMIOFunc &, const llvm::Function *);
-    void isHalPattern();
-    bool isHalPatternInternal(std::string Name, bool Full=false);
+    MMIOFunc(const FindMMIOFunc::MMIOFunc &, const llvm::Function *,
+             PathTable &Paths);
+    void isHalPattern(llvm::StringRef FullPath);
+    HALBypassReportEntry getReportEntry(const PathTable &Paths,
+                                        const MMIOSiteTable &Sites) const;
+    bool isHalPatternInternal(llvm::StringRef Name, bool Full=false);
 
     const llvm::Function *F;
     bool IsHalPattern;
@@ -41,32 +117,125 @@ struct FindHALBypass : public llvm::AnalysisInfoMixin<FindHALBypass> {
     bool NCMA_GroundTruth;
     int InDegree;
     int TransClosureInDeg;
-    std::string FullPath;
-    std::string Dirname;
+    // PathTable IDs of the file of F, of its directory and of the file of
+    // MMIOIns (-1 without a debug location).
+    unsigned FileID;
+    unsigned DirID;
+    int LocFileID;
   };
 
-  using Result = std::map<const llvm::Function *, MMIOFunc>;
+  struct Result : std::map<const llvm::Function *, MMIOFunc> {
+    // Resolves the path IDs of the MMIOFuncs; shared by copies of the result.
+    std::shared_ptr<PathTable> Paths;
+    // The MMIO instructions of the MMIOFuncs (see FindMMIOFunc::Result).
+    std::shared_ptr<const MMIOSiteTable> Sites;
+    bool invalidate(llvm::Module &M, const llvm::PreservedAnalyses &PA,
+                    llvm::ModuleAnalysisManager::Invalidator &);
+  };
   Result run(llvm::Module &M, llvm::ModuleAnalysisManager &);
-  Result runOnModule(llvm::Module &M, const FindMMIOFunc::Result &);
+  // Both analyses in one walk over the instructions of M (see
+  // FlatCallGraph).
+  Result runOnModule(llvm::Module &M);
+  // Both analyses on a lazily loaded module: the functions are materialized
+  // one at a time and the bodies of those without MMIO instructions are
+  // deleted once scanned, so only the MMIO functions stay in memory. With
+  // Index, the module's ThinLTO summary, the call edges are taken from the
+  // summary instead of the function bodies (an error with
+  // -hal-indirect-calls, which needs the bodies). Then, given the GUIDs of the
+  // MMIO functions found by a previous run (Candidates), only their bodies
+  // are read.
+  llvm::Error
+  runOnLazyModule(llvm::Module &M, Result &Res,
+                  const llvm::ModuleSummaryIndex *Index = nullptr,
+                  const llvm::DenseSet<llvm::GlobalValue::GUID> *Candidates =
+                      nullptr);
+  // The first half of runOnLazyModule: fills CG, built from M before any
+  // function is materialized, and MMIOFuncs.
+  static llvm::Error
+  scanLazyModule(llvm::Module &M, FlatCallGraph &CG,
+                 FindMMIOFunc::Result &MMIOFuncs,
+                 const llvm::ModuleSummaryIndex *Index,
+                 const llvm::DenseSet<llvm::GlobalValue::GUID> *Candidates =
+                     nullptr);
   // Part of the official API:
   //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
   static bool isRequired() { return true; }
 
+  // Everything other than the input module that the printed result depends
+  // on: ResultVersion, the LLVM version, the options and the rules. Bump
+  // ResultVersion whenever a change may alter the result for the same input.
+  static const unsigned ResultVersion = 9;
+  static std::string getConfigKey();
+
+  // Transitive closure in-degrees of the nodes of G with the engine selected
+  // by -hal-tc-engine. Queries are the nodes whose in-degree is used; with
+  // the bounded engine, the other nodes are left at 0.
+  static std::vector<int> computeTCInDegrees(const CallGraphCSR &G,
+                                             llvm::ArrayRef<int> Queries);
+  // -hal-tc-threshold: an MMIO function with at least that many transitive
+  // callers marks its directory as a HAL directory.
+  static int getTCThreshold();
+
+  // An MMIO function as seen by the HAL directory rule; Dir is a node of
+  // the DirTree.
+  struct DirRuleFunc {
+    unsigned Dir;
+    int TransClosureInDeg;
+    bool MacroUsed;
+    bool NCMA_CG;
+  };
+  // The HAL directory rule: a function with at least getTCThreshold()
+  // transitive callers marks its directory as HAL or, with
+  // -hal-subtree-depth, the subtree of its directory at that depth. Sets
+  // NCMA_CG of the functions neither macro-used nor in a HAL directory,
+  // and writes -hal-dir-rollup.
+  static void applyHalDirRule(DirTree &Tree,
+                              llvm::MutableArrayRef<DirRuleFunc> Funcs);
+
+  // Transitive closure in-degree engines (see CallGraphTC.cpp). They depend
+  // on the graph only, so they are usable outside the pass, e.g. by
+  // tc-est-bench.
+  static std::vector<int> runFloydWarshall(const CallGraphCSR &G);
+  static std::vector<int> runTCExact(const CallGraphCSR &G);
+  static std::vector<int> runTCBounded(const CallGraphCSR &G,
+                                       llvm::ArrayRef<int> Queries,
+                                       int Threshold);
+  static std::vector<int> runTCEst(const CallGraphCSR &G,
+                                   const TCEstOptions &Opts = TCEstOptions());
+  static std::vector<double> runTCEstOneIter(const CallGraphCSR &G,
+                                             uint64_t Seed, unsigned Iter);
+  // The SCCs of a graph numbered in topological order, callers first (see
+  // CallGraphTC.cpp).
+  struct Condensation {
+    int NumSCCs = 0;
+    std::vector<int> SCCOf;
+    std::vector<int> SCCBegin;
+    std::vector<int> Members;
+  };
+  static std::vector<double> runTCEstSketch(const CallGraphCSR &G,
+                                            const Condensation &C,
+                                            uint64_t Seed, unsigned FirstIter,
+                                            unsigned NumLanes);
+
 private:
   // A special type used by analysis passes to provide an address that
   // identifies that particular analysis pass type.
   static llvm::AnalysisKey Key;
   friend struct llvm::AnalysisInfoMixin<FindHALBypass>;
 
-  void callGraphBasedHalIdent(llvm::CallGraph &CG);
-  void computeCallGraphInDeg(llvm::CallGraph &CG);
-  void computeCallGraphTCInDeg(llvm::CallGraph &CG);
-  std::vector<int> runFloydWarshall(std::vector<int> &AdjMatrix, int);
-  std::vector<int> runTCEst(std::vector<int> &AdjMatrix, int);
-  std::vector<double> runTCEstOneIter(std::vector<int> &AdjMatrix, int);
+  Result runOnCallGraph(FlatCallGraph &CG, const FindMMIOFunc::Result &);
+  void callGraphBasedHalIdent(FlatCallGraph &CG);
+  void computeCallGraphInDeg(const FlatCallGraph &CG);
+  void computeCallGraphTCInDeg(FlatCallGraph &CG);
   int CallGraphTCInDegPctl(double percent);
+  void writeSnapshot(llvm::StringRef Path);
 
   Result MMIOFuncMap;
+  // With -hal-snapshot, the call graph numbered as the FlatCallGraph and
+  // the function of each node (null for the external nodes), until the
+  // snapshot is written.
+  CallGraphCSR Graph;
+  std::vector<const llvm::Function *> GraphFuncs;
   int CGNumOfNodes;
   int CGNumOfEdges;
 };
@@ -77,15 +246,33 @@ private:
 class FindHALBypassPrinter
     : public llvm::PassInfoMixin<FindHALBypassPrinter> {
 public:
-  explicit FindHALBypassPrinter(llvm::raw_ostream &OutS) : OS(OutS) {}
+  // Text is the human-readable report; JSONL has one JSON object per MMIO
+  // function and line.
+  enum class Format { Text, JSONL };
+
+  explicit FindHALBypassPrinter(llvm::raw_ostream &OutS,
+                                Format Fmt = Format::Text)
+      : OS(OutS), Fmt(Fmt) {}
+  // Prints to OutFile, which the printer owns.
+  FindHALBypassPrinter(std::unique_ptr<llvm::raw_ostream> OutFile, Format Fmt)
+      : OwnedOS(std::move(OutFile)), OS(*OwnedOS), Fmt(Fmt) {}
+  // The printer for the parameters of print<hal-bypass;...>: Params is
+  // "" or ";"-separated "format=text|jsonl" and "out=<path>" ("-" for
+  // stdout; stderr by default).
+  static llvm::Expected<FindHALBypassPrinter> create(llvm::StringRef Params);
   llvm::PreservedAnalyses run(llvm::Module &M,
                               llvm::ModuleAnalysisManager &MAM);
+  // Prints a result computed outside of a pass manager.
+  void print(const FindHALBypass::Result &Res);
+  void print(llvm::ArrayRef<HALBypassReportEntry> Entries);
   // Part of the official API:
   //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
   static bool isRequired() { return true; }
 
 private:
+  std::unique_ptr<llvm::raw_ostream> OwnedOS;
   llvm::raw_ostream &OS;
+  Format Fmt;
 };
 
 //------------------------------------------------------------------------------
@@ -13,13 +13,25 @@
 #ifndef LLVM_TUTOR_FINDMMIOFUNC_H
 #define LLVM_TUTOR_FINDMMIOFUNC_H
 
+#include "FlatCallGraph.h"
+#include "MMIOSiteTable.h"
+
 //#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/IR/AbstractCallSite.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include <map>
+#include <memory>
+
+struct FunctionSummary;
+
+// -mmio-scan-threads, set by tools that already run analyses in parallel
+// (see halvd).
+extern llvm::cl::opt<unsigned> MMIOScanThreads;
 
 //------------------------------------------------------------------------------
 // New PM interface
@@ -38,6 +50,21 @@
   } while (false)
 #endif
 
+// The analyses below (FindMMIOFunc, FindHALBypass) only depend on the
+// function bodies and on the functions of the module. A pass that changes
+// neither, e.g. a cleanup of globals or metadata, keeps their cached
+// results with
+//   PA.preserveSet<HALBypassAnalyses>();
+// Preserving LazyCallGraphAnalysis does not imply it: the CGSCC pass
+// manager preserves it while its passes rewrite the bodies.
+class HALBypassAnalyses {
+public:
+  static llvm::AnalysisSetKey *ID() { return &SetKey; }
+
+private:
+  static llvm::AnalysisSetKey SetKey;
+};
+
 struct FindMMIOFunc : public llvm::AnalysisInfoMixin<FindMMIOFunc> {
   struct MMIOFunc {
     explicit MMIOFunc(const llvm::Instruction *I, bool Macro)
@@ -45,10 +72,49 @@ struct FindMMIOFunc : public llvm::AnalysisInfoMixin<FindMMIOFunc> {
     // const llvm::Function *Func;
     const llvm::Instruction *MMIOIns;
     bool MacroUsed;
+    // Shared summary of the function (see FunctionSummary.h), if any.
+    FunctionSummary *Summary = nullptr;
+    // All the MMIO instructions of the function, MMIOIns first, are
+    // Result::Sites[FirstSite, FirstSite + NumSites) (before buildSiteTable,
+    // the same range of the Sites given to addFunction); MinAddr and MaxAddr
+    // are the lowest and highest known addresses they access (0 and 0 if
+    // none is known, see MMIOSiteTable::hasAddress).
+    unsigned FirstSite = 0;
+    unsigned NumSites = 0;
+    uint64_t MinAddr = 0;
+    uint64_t MaxAddr = 0;
+  };
+  struct Result : std::map<const llvm::Function *, MMIOFunc> {
+    // The MMIO instructions of the functions, grouped by function in module
+    // order.
+    std::shared_ptr<const MMIOSiteTable> Sites;
+    bool invalidate(llvm::Module &M, const llvm::PreservedAnalyses &PA,
+                    llvm::ModuleAnalysisManager::Invalidator &);
   };
-  using Result = std::map<const llvm::Function *, MMIOFunc>;
   Result run(llvm::Module &M, llvm::ModuleAnalysisManager &);
-  Result runOnModule(llvm::Module &M);
+  // With CG, the walk that finds the MMIO instructions also appends the
+  // call edges of every function body to CG.
+  Result runOnModule(llvm::Module &M, FlatCallGraph *CG = nullptr);
+  // Adds Func to MMIOFuncs if it has an MMIO instruction, for drivers that
+  // materialize the functions of a module one at a time, and appends its
+  // MMIO instructions to Sites. With CG, also appends the call edges of
+  // Func to CG.
+  bool addFunction(llvm::Function &Func, Result &MMIOFuncs,
+                   std::vector<const llvm::Instruction *> &Sites,
+                   FlatCallGraph *CG = nullptr);
+  // Sets MMIOFuncs.Sites to the table of Sites, the MMIO instructions of
+  // its functions at their site ranges, and their address ranges.
+  // runOnModule calls it; drivers using addFunction call it after adding
+  // the last function.
+  static void buildSiteTable(Result &MMIOFuncs,
+                             llvm::ArrayRef<const llvm::Instruction *> Sites);
+  // Constant address accessed by Ins, an MMIO instruction, or None if it
+  // does not fit in 64 bits.
+  static llvm::Optional<uint64_t> getMMIOAddress(const llvm::Instruction &Ins);
+  // Whether PA invalidates a result of the analysis ID, one of the
+  // HALBypassAnalyses.
+  static bool isInvalidated(llvm::AnalysisKey *ID,
+                            const llvm::PreservedAnalyses &PA);
   // Part of the official API:
   //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
   static bool isRequired() { return true; }
@@ -62,7 +128,23 @@ private:
   template <typename InstTy>
   bool isMMIOInst_(llvm::Instruction *Ins);
   bool isMMIOInst(llvm::Instruction *Ins);
-  void findMMIOFunc(llvm::Module &M, Result &MMIOFuncs);
+  // Appends the MMIO instructions of Func not inlined from another function
+  // to Sites, and returns the first one. With CG, the same walk adds the
+  // call edges of Func to Body.
+  const llvm::Instruction *
+  findMMIOInst(llvm::Function &Func,
+               std::vector<const llvm::Instruction *> &Sites,
+               const FlatCallGraph *CG = nullptr,
+               FlatCallGraph::BodyEdges *Body = nullptr);
+  // findMMIOInst, and ignoreFunc for an MMIO function, answered from the
+  // summary store when -hal-summary-cache is on. Returns the summary of
+  // Func, if any.
+  FunctionSummary *scanFunc(llvm::Function &Func,
+                            std::vector<const llvm::Instruction *> &Sites,
+                            const llvm::Instruction *&Site, bool &MacroUsed,
+                            const FlatCallGraph *CG = nullptr,
+                            FlatCallGraph::BodyEdges *Body = nullptr);
+  void findMMIOFunc(llvm::Module &M, Result &MMIOFuncs, FlatCallGraph *CG);
   bool ignoreFunc(llvm::Function &F);
 };
 
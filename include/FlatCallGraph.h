@@ -0,0 +1,119 @@
+//========================================================================
+// FILE:
+//    FlatCallGraph.h
+//
+// DESCRIPTION:
+//    Call graph of a module with the nodes and edges of llvm::CallGraph,
+//    kept as flat arrays indexed by function ordinal: node N < numFuncs()
+//    is the N-th function of the module (debug intrinsics excepted, as in
+//    llvm::CallGraph), followed by the external calling node and the
+//    calls-external node.
+//
+//    The edges from the function bodies are added by the walk over the
+//    instructions that also looks for MMIO instructions (see
+//    FindMMIOFunc::runOnModule), so the IR is read once and no node is
+//    allocated per function.
+//
+//    With -hal-indirect-calls, indirect calls also get edges to the
+//    address-taken functions of the same signature (see
+//    resolveIndirectCalls).
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_FLATCALLGRAPH_H
+#define LLVM_TUTOR_FLATCALLGRAPH_H
+
+#include "CallGraphCSR.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Module.h"
+#include <string>
+#include <vector>
+
+class FlatCallGraph {
+public:
+  using Edge = CallGraphCSR::Edge;
+
+  // A struct field holding function pointers; Struct is null for none.
+  struct Field {
+    llvm::StructType *Struct = nullptr;
+    unsigned Index = 0;
+  };
+  // A function whose address is taken, stored into Into if known.
+  struct Target {
+    int Node;
+    Field Into;
+  };
+  struct IndirectCall {
+    int Caller;
+    llvm::FunctionType *Type;
+    // Field the callee was loaded from, if known.
+    Field From;
+  };
+  // What walks over function bodies collect. Walks only read the graph, so
+  // functions can be walked in parallel, each into its own BodyEdges.
+  struct BodyEdges {
+    std::vector<Edge> Edges;
+    // With -hal-indirect-calls only.
+    std::vector<IndirectCall> IndirectCalls;
+    std::vector<Target> Targets;
+  };
+
+  // Numbers the functions of M and adds the edges that do not come from a
+  // body: from the external calling node to the functions callable from
+  // outside, and from the declarations to the calls-external node. For a
+  // lazily loaded M, build it before materializing any function.
+  explicit FlatCallGraph(llvm::Module &M);
+
+  int numFuncs() const { return static_cast<int>(Funcs.size()); }
+  int numNodes() const { return numFuncs() + 2; }
+  int externalCallingNode() const { return numFuncs(); }
+  int callsExternalNode() const { return numFuncs() + 1; }
+
+  // Function of node N, null for the external nodes.
+  const llvm::Function *getFunction(int N) const {
+    return N < numFuncs() ? Funcs[N] : nullptr;
+  }
+  // Node of F, a function of the module.
+  int getNode(const llvm::Function *F) const { return Nodes.lookup(F); }
+
+  // Adds what instruction I, in Caller, contributes to Out: the edges of a
+  // call, as CallGraph::populateCallGraphNode, and, with
+  // -hal-indirect-calls, its indirect call or the functions whose address
+  // it takes.
+  void addInstruction(int Caller, const llvm::Instruction &I,
+                      BodyEdges &Out) const;
+  // addInstruction for all the instructions of F.
+  void addBody(const llvm::Function &F, BodyEdges &Out) const;
+
+  void addEdge(int Caller, int Callee) { Edges.push_back({Caller, Callee}); }
+  void addBodyEdges(const BodyEdges &B);
+  // Adds the edges of the indirect calls collected so far (see
+  // -hal-indirect-calls), once all the bodies were added. Indirect calls
+  // keep their edge to the calls-external node.
+  void resolveIndirectCalls();
+
+  // Edges so far, duplicates included (one per call, as in CallGraph).
+  llvm::ArrayRef<Edge> edges() const { return Edges; }
+  std::vector<Edge> takeEdges() { return std::move(Edges); }
+
+  // Whether indirect calls get edges to candidate callees
+  // (-hal-indirect-calls other than none).
+  static bool resolvesIndirectCalls();
+  // The options the edges depend on, for result caches.
+  static std::string getConfigKey();
+
+private:
+  void addInitializerTargets(const llvm::Constant *C, Field Into);
+
+  std::vector<const llvm::Function *> Funcs;
+  llvm::DenseMap<const llvm::Function *, int> Nodes;
+  std::vector<Edge> Edges;
+  std::vector<IndirectCall> IndirectCalls;
+  std::vector<Target> Targets;
+};
+
+#endif // LLVM_TUTOR_FLATCALLGRAPH_H
@@ -0,0 +1,65 @@
+//========================================================================
+// FILE:
+//    FunctionSummary.h
+//
+// DESCRIPTION:
+//    Declares the per-function summary store. Whether an MMIO function uses
+//    a macro HAL function or matches a HAL pattern depends only on its
+//    names and source file, not on the application it is linked into. With
+//    -hal-summary-cache, these results of FindMMIOFunc and FindHALBypass
+//    are kept per function for the lifetime of the process, so that the
+//    rules are matched once against vendor code compiled into many
+//    applications of a batch run (see halvd). The scan for MMIO
+//    instructions is not cached: it also collects the call edges.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_FUNCTIONSUMMARY_H
+#define LLVM_TUTOR_FUNCTIONSUMMARY_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+// -hal-summary-cache.
+extern llvm::cl::opt<bool> HalSummaryCache;
+
+struct FunctionSummary {
+  explicit FunctionSummary(bool MacroUsed)
+      : MacroUsed(MacroUsed), GroundTruth(-1) {}
+
+  // FindMMIOFunc::MMIOFunc::MacroUsed.
+  bool MacroUsed;
+  // FindHALBypass::MMIOFunc::NCMA_GroundTruth, or -1 until computed.
+  std::atomic<signed char> GroundTruth;
+};
+
+class FunctionSummaryStore {
+public:
+  using Key = std::pair<uint64_t, uint64_t>;
+
+  // The store of the process, or nullptr without -hal-summary-cache.
+  static FunctionSummaryStore *get();
+
+  // Hash of everything the summary of F depends on: its name and its
+  // DISubprogram names and file. It costs far less than the rules it saves.
+  static Key getKey(const llvm::Function &F);
+
+  // nullptr if there is no summary for K yet.
+  FunctionSummary *lookup(Key K);
+  // Adds a summary for K, or returns the one added meanwhile by another
+  // thread.
+  FunctionSummary *insert(Key K, bool MacroUsed);
+
+private:
+  std::mutex Mutex;
+  llvm::BumpPtrAllocator Alloc;
+  llvm::DenseMap<Key, FunctionSummary *> Summaries;
+};
+
+#endif // LLVM_TUTOR_FUNCTIONSUMMARY_H
@@ -0,0 +1,104 @@
+//========================================================================
+// FILE:
+//    HalRules.h
+//
+// DESCRIPTION:
+//    Declares the pattern rules used to classify MMIO functions:
+//      * PatternSet: a set of regular expressions matched together. An
+//        Aho-Corasick automaton over the literal prefixes of the patterns
+//        finds candidate positions in one scan of the text; only those are
+//        verified with the regular expressions.
+//      * HalRules: the rule sets loaded from a rule file (-hal-rules, or the
+//        built-in rules/default.rules), compiled once per process.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_HALRULES_H
+#define LLVM_TUTOR_HALRULES_H
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <vector>
+
+class PatternSet {
+public:
+  enum MatchKind {
+    // A match anywhere in the text.
+    Anywhere,
+    // A match neither preceded nor followed by a letter.
+    Word,
+  };
+
+  PatternSet(MatchKind Kind, bool IgnoreCase)
+      : Kind(Kind), IgnoreCase(IgnoreCase) {}
+
+  // Adds a pattern. Returns false and sets Err if it is not a valid
+  // regular expression.
+  bool add(llvm::StringRef Pattern, std::string &Err);
+  // Builds the automaton; must be called after the last add().
+  void compile();
+
+  bool empty() const { return Rules.empty(); }
+  // Whether any pattern matches in Text.
+  bool matches(llvm::StringRef Text) const;
+  // Text with every match of the patterns removed.
+  std::string strip(llvm::StringRef Text) const;
+
+private:
+  struct Rule {
+    std::string Prefix;
+    // Matches the pattern (and the word boundary after it, for Word) at the
+    // start of the searched range.
+    std::regex Anchored;
+  };
+
+  bool verify(const Rule &R, llvm::StringRef Text, size_t Pos) const;
+
+  MatchKind Kind;
+  bool IgnoreCase;
+  std::vector<Rule> Rules;
+  std::vector<std::string> Patterns;
+  // Rules without a literal prefix, verified at every position.
+  std::vector<unsigned> Unprefixed;
+  // Alternation of all the patterns, for strip().
+  std::regex Combined;
+  // Aho-Corasick automaton: Delta[State * 256 + Byte] is the next state and
+  // Out[State] the rules whose prefix ends in State.
+  std::vector<int> Delta;
+  std::vector<std::vector<unsigned>> Out;
+};
+
+class HalRules {
+public:
+  // The rules of the process, loaded on first use.
+  static const HalRules &get();
+
+  // Parses rules in the rules/default.rules format. Returns false and sets
+  // Err on a malformed rule.
+  bool parse(llvm::StringRef Buffer, std::string &Err);
+
+  // Whether Name (a function name or a file path) matches a HAL pattern.
+  // With Full, project-specific patterns are included.
+  bool isHalName(llvm::StringRef Name, bool Full) const;
+  // Whether a function is known to use macro HAL functions, by the path of
+  // its file or by its name.
+  bool isIgnoredPath(llvm::StringRef Path) const;
+  bool isIgnoredFunc(llvm::StringRef Name) const;
+  // Hash of the text the rules were parsed from.
+  uint64_t getHash() const { return Hash; }
+
+private:
+  HalRules();
+
+  PatternSet Strip;
+  PatternSet HalExclude;
+  PatternSet Hal;
+  PatternSet HalFull;
+  PatternSet IgnorePath;
+  PatternSet IgnoreFunc;
+  uint64_t Hash = 0;
+};
+
+#endif // LLVM_TUTOR_HALRULES_H
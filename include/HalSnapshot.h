@@ -0,0 +1,127 @@
+//========================================================================
+// FILE:
+//    HalSnapshot.h
+//
+// DESCRIPTION:
+//    Binary snapshot of a FindHALBypass result: the call graph in CSR form,
+//    the function names, the interned source paths and one record per MMIO
+//    function. Written with -hal-snapshot=<file>.
+//
+//    The file has the layout of SectionLayout.h (little-endian, 4-byte
+//    aligned sections at offsets given in the header), so HalSnapshot
+//    reads a memory-mapped file in place: opening one only validates it.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_HALSNAPSHOT_H
+#define LLVM_TUTOR_HALSNAPSHOT_H
+
+#include "CallGraphCSR.h"
+#include "SectionLayout.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+
+namespace halsnap {
+using llvm::support::little32_t;
+using llvm::support::ulittle32_t;
+using layout::Section;
+
+// Bump when the layout changes; readers reject other versions.
+static const uint32_t Version = 1;
+
+struct Header {
+  char Magic[8]; // "HALSNAP\0"
+  ulittle32_t Version;
+  ulittle32_t NumNodes;
+  // Forward CSR: the callees of node N are
+  // Targets[Offsets[N]..Offsets[N+1]); likewise for callers with ROffsets
+  // and RTargets.
+  Section Offsets;
+  Section Targets;
+  Section ROffsets;
+  Section RTargets;
+  // Per node, the offset of its NUL-terminated name in Strings.
+  Section NodeNames;
+  // Per path ID, the offset of the NUL-terminated path in Strings.
+  Section Paths;
+  Section MMIOFuncs;
+  Section Strings;
+};
+
+struct MMIOFunc {
+  ulittle32_t Node;
+  // Path IDs of the function's file and directory.
+  ulittle32_t FileID;
+  ulittle32_t DirID;
+  // Path ID of the file of the MMIO instruction, -1 without a debug
+  // location.
+  little32_t LocFileID;
+  ulittle32_t Line;
+  ulittle32_t Col;
+  little32_t TransClosureInDeg;
+  uint8_t NCMA_CG;
+  uint8_t NCMA_GroundTruth;
+  uint8_t MacroUsed;
+  uint8_t Reserved;
+};
+
+// Writes a snapshot. NodeNames and Paths are indexed by node and path ID.
+void write(llvm::raw_ostream &OS, const CallGraphCSR &G,
+           llvm::ArrayRef<llvm::StringRef> NodeNames,
+           llvm::ArrayRef<llvm::StringRef> Paths,
+           llvm::ArrayRef<MMIOFunc> MMIOFuncs);
+} // namespace halsnap
+
+// A snapshot opened for reading. The accessors point into the mapped file.
+class HalSnapshot {
+public:
+  static llvm::Expected<std::unique_ptr<HalSnapshot>>
+  open(llvm::StringRef Path);
+  static llvm::Expected<std::unique_ptr<HalSnapshot>>
+  open(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+  unsigned numNodes() const { return H->NumNodes; }
+  size_t numEdges() const { return Targets.size(); }
+
+  // Callees of N.
+  llvm::ArrayRef<halsnap::ulittle32_t> succs(unsigned N) const {
+    return Targets.slice(Offsets[N], Offsets[N + 1] - Offsets[N]);
+  }
+  // Callers of N.
+  llvm::ArrayRef<halsnap::ulittle32_t> preds(unsigned N) const {
+    return RTargets.slice(ROffsets[N], ROffsets[N + 1] - ROffsets[N]);
+  }
+
+  llvm::StringRef getName(unsigned N) const {
+    return getString(NodeNames[N]);
+  }
+  llvm::StringRef getPath(unsigned ID) const { return getString(Paths[ID]); }
+  unsigned numPaths() const { return static_cast<unsigned>(Paths.size()); }
+  llvm::ArrayRef<halsnap::MMIOFunc> mmioFuncs() const { return MMIOFuncs; }
+
+  // Node named Name, or -1. Linear in the number of nodes.
+  int findNode(llvm::StringRef Name) const;
+
+private:
+  HalSnapshot() = default;
+  llvm::Error validate() const;
+  llvm::StringRef getString(uint32_t Offset) const {
+    return llvm::StringRef(Strings.data() + Offset);
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  const halsnap::Header *H = nullptr;
+  llvm::ArrayRef<halsnap::ulittle32_t> Offsets, Targets, ROffsets, RTargets,
+      NodeNames, Paths;
+  llvm::ArrayRef<halsnap::MMIOFunc> MMIOFuncs;
+  llvm::ArrayRef<char> Strings;
+};
+
+#endif // LLVM_TUTOR_HALSNAPSHOT_H
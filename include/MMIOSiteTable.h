@@ -0,0 +1,67 @@
+//========================================================================
+// FILE:
+//    MMIOSiteTable.h
+//
+// DESCRIPTION:
+//    Declares MMIOSiteTable, every MMIO instruction of the MMIO functions
+//    of a module. The table is a structure of arrays (address, access
+//    kind, width, debug location, function, whether the address is known)
+//    in a single allocation, with
+//    the sites of a function contiguous and in program order, so that a
+//    function's sites are one index range (see FindMMIOFunc::MMIOFunc).
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_MMIOSITETABLE_H
+#define LLVM_TUTOR_MMIOSITETABLE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Instruction.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class MMIOSiteTable {
+public:
+  enum AccessKind : uint8_t { Load, Store, GEP };
+
+  MMIOSiteTable() = default;
+  // The table of Sites, MMIO instructions grouped by function; Funcs[I] is
+  // the index of the function of Sites[I].
+  MMIOSiteTable(llvm::ArrayRef<const llvm::Instruction *> Sites,
+                llvm::ArrayRef<uint32_t> Funcs);
+  MMIOSiteTable(const MMIOSiteTable &) = delete;
+  MMIOSiteTable &operator=(const MMIOSiteTable &) = delete;
+
+  size_t size() const { return NumSites; }
+  // Whether the accessed address is known: it is not if the constant does
+  // not fit in 64 bits or is not an integer.
+  bool hasAddress(size_t I) const { return HasAddrs[I]; }
+  // Accessed address, if hasAddress(I) (0 otherwise).
+  uint64_t getAddress(size_t I) const { return Addresses[I]; }
+  AccessKind getKind(size_t I) const {
+    return static_cast<AccessKind>(Kinds[I]);
+  }
+  // Bytes loaded or stored, 0 for a GEP.
+  unsigned getWidth(size_t I) const { return Widths[I]; }
+  // ID of the debug location, 0 for none.
+  uint32_t getLocID(size_t I) const { return LocIDs[I]; }
+  const llvm::DILocation *getLoc(uint32_t ID) const { return Locs[ID]; }
+  uint32_t getFunc(size_t I) const { return Funcs[I]; }
+
+private:
+  size_t NumSites = 0;
+  std::unique_ptr<char[]> Storage;
+  // Columns in Storage, widest first.
+  uint64_t *Addresses = nullptr;
+  uint32_t *LocIDs = nullptr;
+  uint32_t *Funcs = nullptr;
+  uint16_t *Widths = nullptr;
+  uint8_t *Kinds = nullptr;
+  uint8_t *HasAddrs = nullptr;
+  // Distinct debug locations; Locs[0] is null.
+  std::vector<const llvm::DILocation *> Locs = {nullptr};
+};
+
+#endif // LLVM_TUTOR_MMIOSITETABLE_H
@@ -0,0 +1,55 @@
+//========================================================================
+// FILE:
+//    PathTable.h
+//
+// DESCRIPTION:
+//    Declares PathTable, a per-module table of interned source paths. The
+//    path of each DIFile is resolved once and stored in a bump allocator;
+//    paths are then referred to by stable integer IDs, so grouping and
+//    comparing paths is an integer comparison.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_PATHTABLE_H
+#define LLVM_TUTOR_PATHTABLE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include <string>
+#include <vector>
+
+class PathTable {
+public:
+  PathTable();
+  PathTable(const PathTable &) = delete;
+  PathTable &operator=(const PathTable &) = delete;
+
+  // ID of the normalized "<directory>/<filename>" path of File. Resolved
+  // once per DIFile.
+  unsigned getFileID(const llvm::DIFile *File);
+  // ID of the directory part of the path with the given ID.
+  unsigned getDirID(unsigned ID);
+  // ID of Path, interning it if needed.
+  unsigned intern(llvm::StringRef Path);
+
+  llvm::StringRef getPath(unsigned ID) const { return Paths[ID]; }
+  unsigned size() const { return static_cast<unsigned>(Paths.size()); }
+
+private:
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Saver;
+  // Keys point into Alloc.
+  llvm::DenseMap<llvm::StringRef, unsigned> IDs;
+  llvm::DenseMap<const llvm::DIFile *, unsigned> FileIDs;
+  std::vector<llvm::StringRef> Paths;
+  // DirIDs[ID] is the ID of the directory of path ID, or -1 if not computed
+  // yet.
+  std::vector<int> DirIDs;
+  // Working directory, used to resolve relative paths.
+  std::string CWD;
+};
+
+#endif // LLVM_TUTOR_PATHTABLE_H
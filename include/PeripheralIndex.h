@@ -0,0 +1,85 @@
+//========================================================================
+// FILE:
+//    PeripheralIndex.h
+//
+// DESCRIPTION:
+//    Declares PeripheralIndex, the address ranges of the peripherals and
+//    registers of a device, read from CMSIS-SVD files (-hal-svd). The SVD
+//    files are read with a streaming reader (no document tree is built)
+//    into two sorted arrays of disjoint intervals, one for the peripherals
+//    and one for the registers, so attributing an MMIO address costs two
+//    binary searches. The index is loaded once per process and shared by
+//    the modules of a batch run (see halvd).
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_PERIPHERALINDEX_H
+#define LLVM_TUTOR_PERIPHERALINDEX_H
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class PeripheralIndex {
+public:
+  // The peripheral and register an address falls in; -1 for none.
+  struct Match {
+    int Peripheral = -1;
+    int Register = -1;
+  };
+
+  // The index of the process, loaded on first use, or nullptr without
+  // -hal-svd.
+  static const PeripheralIndex *get();
+
+  // Adds the peripherals of an SVD file. Returns false and sets Err if it
+  // is malformed.
+  bool parse(llvm::StringRef Buffer, std::string &Err);
+  // Sorts the ranges; must be called after the last parse(). Where ranges
+  // overlap, those parsed first win.
+  void finalize();
+
+  Match lookup(uint64_t Addr) const;
+  llvm::StringRef getPeripheralName(int P) const {
+    return Peripherals[P].Name;
+  }
+  uint64_t getPeripheralBase(int P) const { return Peripherals[P].Base; }
+  llvm::StringRef getRegisterName(int R) const { return RegisterNames[R]; }
+  size_t numPeripherals() const { return Peripherals.size(); }
+  // Hash of the files the index was parsed from.
+  uint64_t getHash() const { return Hash; }
+
+private:
+  struct Peripheral {
+    std::string Name;
+    uint64_t Base;
+  };
+  // Half-open [Start, End) intervals of one kind, sorted and disjoint; the
+  // starts are kept apart so that the binary search only touches them.
+  struct Intervals {
+    struct Span {
+      uint64_t End;
+      int ID;
+    };
+    void add(uint64_t Start, uint64_t End, int ID);
+    void finalize();
+    // ID of the interval holding Addr, or -1.
+    int lookup(uint64_t Addr) const;
+
+    // Intervals in the order added, until finalize().
+    std::vector<std::pair<uint64_t, Span>> Added;
+    std::vector<uint64_t> Starts;
+    std::vector<Span> Spans;
+  };
+
+  PeripheralIndex() = default;
+
+  std::vector<Peripheral> Peripherals;
+  std::vector<std::string> RegisterNames;
+  Intervals PeripheralRanges;
+  Intervals RegisterRanges;
+  uint64_t Hash = 0;
+};
+
+#endif // LLVM_TUTOR_PERIPHERALINDEX_H
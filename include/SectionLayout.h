@@ -0,0 +1,93 @@
+//========================================================================
+// FILE:
+//    SectionLayout.h
+//
+// DESCRIPTION:
+//    The file layout shared by the binary formats read in place (the
+//    -hal-snapshot snapshots and the halagg summaries): a header starting
+//    with an 8-byte magic, followed by sections, each an array of
+//    little-endian elements at a 4-byte aligned offset given in the header.
+//    Readers map the file and point into it once the header and sections
+//    are validated. Header-only, so that tools need no library for it.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_SECTIONLAYOUT_H
+#define LLVM_TUTOR_SECTIONLAYOUT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <cstring>
+
+namespace layout {
+// A section: Count elements starting Offset bytes into the file.
+struct Section {
+  llvm::support::ulittle64_t Offset;
+  llvm::support::ulittle64_t Count;
+};
+
+// Lays out sections one after the other, after a header of HeaderSize
+// bytes.
+class Layout {
+public:
+  explicit Layout(uint64_t HeaderSize) : End(HeaderSize) {}
+  template <typename T> void add(Section &S, llvm::ArrayRef<T> A) {
+    S.Offset = End;
+    S.Count = A.size();
+    End = llvm::alignTo(End + A.size() * sizeof(T), 4);
+  }
+
+private:
+  uint64_t End;
+};
+
+// Writes the elements of a section, then pads to the next section; the
+// sections must be written in the order they were added to the Layout.
+template <typename T>
+void writeSection(llvm::raw_ostream &OS, llvm::ArrayRef<T> A) {
+  OS.write(reinterpret_cast<const char *>(A.data()), A.size() * sizeof(T));
+  OS.write_zeros(llvm::offsetToAlignment(OS.tell(), llvm::Align(4)));
+}
+
+// The header at the start of Data, or nullptr if Data is too small for one
+// or does not start with Magic.
+template <typename HeaderT>
+const HeaderT *getHeader(llvm::StringRef Data, const char (&Magic)[8]) {
+  if (Data.size() < sizeof(HeaderT) ||
+      std::memcmp(Data.data(), Magic, sizeof(Magic)))
+    return nullptr;
+  return reinterpret_cast<const HeaderT *>(Data.data());
+}
+
+// Points A at section S of Data. Returns false if the section is misaligned
+// or out of bounds.
+template <typename T>
+bool getSection(llvm::StringRef Data, const Section &S,
+                llvm::ArrayRef<T> &A) {
+  uint64_t Offset = S.Offset, Count = S.Count;
+  if (Offset % 4 || Offset > Data.size() ||
+      Count > (Data.size() - Offset) / sizeof(T))
+    return false;
+  A = llvm::makeArrayRef(reinterpret_cast<const T *>(Data.data() + Offset),
+                         Count);
+  return true;
+}
+
+// Whether every offset in Offsets starts a NUL-terminated string of Blob.
+inline bool
+isStringTable(llvm::ArrayRef<char> Blob,
+              llvm::ArrayRef<llvm::support::ulittle32_t> Offsets) {
+  if (!Blob.empty() && Blob.back() != '\0')
+    return false;
+  for (uint32_t Offset : Offsets)
+    if (Offset >= Blob.size())
+      return false;
+  return true;
+}
+} // namespace layout
+
+#endif // LLVM_TUTOR_SECTIONLAYOUT_H
@@ -0,0 +1,112 @@
+//========================================================================
+// FILE:
+//    UnionCallGraph.h
+//
+// DESCRIPTION:
+//    Declares UnionCallGraph, the call graph of a program built from many
+//    separately compiled bitcode units. Each unit is scanned on its own and
+//    only its call edges and MMIO functions are kept; non-local functions
+//    are resolved by name across units, so the IR is never linked. Memory
+//    is proportional to the number of functions and edges, not to the IR.
+//    Units are merged in the order of their IDs, whatever the order they
+//    were added in, so the report does not depend on thread scheduling.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_UNIONCALLGRAPH_H
+#define LLVM_TUTOR_UNIONCALLGRAPH_H
+
+#include "CallGraphCSR.h"
+#include "DirTree.h"
+#include "FindHALBypass.h"
+#include "PathTable.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSummaryIndex.h"
+#include "llvm/Support/Error.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+class UnionCallGraph {
+public:
+  UnionCallGraph();
+
+  // Adds the functions, call edges and MMIO functions of unit M, which must
+  // be lazily loaded (see FindHALBypass::scanLazyModule). M can be
+  // destroyed afterwards. Units may be added concurrently; UnitID, e.g. the
+  // position of the unit among the inputs, orders them for the merge.
+  llvm::Error
+  addUnit(unsigned UnitID, llvm::Module &M,
+          const llvm::ModuleSummaryIndex *Index = nullptr,
+          const llvm::DenseSet<llvm::GlobalValue::GUID> *Candidates = nullptr);
+
+  // Merges the units added so far and runs the transitive closure and HAL
+  // directory logic of FindHALBypass over the union. Call once, after the
+  // last addUnit.
+  std::vector<HALBypassReportEntry> computeReport();
+
+private:
+  // Node numbers of the CallGraph external nodes.
+  enum : int { ExternalCallingNode = 0, CallsExternalNode = 1 };
+
+  struct MMIOFunc {
+    HALBypassReportEntry Entry;
+    // Node of its directory in Dirs.
+    unsigned DirID;
+  };
+
+  // How a unit provides a function. For a function defined in several
+  // units, the body kept is the first Definition in unit order, else the
+  // first Overridable one, as a linker would.
+  enum class FuncKind : uint8_t {
+    Intrinsic,
+    Declaration,
+    // Weak, linkonce or available_externally body.
+    Overridable,
+    Definition
+  };
+
+  // What addUnit keeps of a unit, numbered as in its FlatCallGraph.
+  struct Unit {
+    struct MMIOFunc {
+      int Func;
+      HALBypassReportEntry Entry;
+      std::string Dir;
+    };
+    // Per function: its name, kind and whether it has local linkage.
+    std::vector<std::string> Names;
+    std::vector<FuncKind> Kinds;
+    llvm::BitVector Local;
+    // Call edges, without those of declarations.
+    std::vector<CallGraphCSR::Edge> Edges;
+    std::vector<MMIOFunc> MMIOFuncs;
+  };
+
+  int getNode(llvm::StringRef Name, bool Local);
+  void merge();
+
+  std::mutex Mutex;
+  // Units added and not merged yet, by ID.
+  std::map<unsigned, Unit> Units;
+
+  int NumNodes;
+  // Node of each non-local function; local functions get a node per unit.
+  llvm::StringMap<int> Symbols;
+  // Edges of the bodies kept, duplicates included.
+  std::vector<CallGraphCSR::Edge> Edges;
+  // Per node: defined in some unit; declared (not as an intrinsic) in some
+  // unit. A function declared but never defined calls external code, as
+  // in CallGraph.
+  llvm::BitVector Defined;
+  llvm::BitVector Declared;
+  // MMIO functions by node; for a function defined in several units (e.g.
+  // weak or linkonce), the one of the body kept (see FuncKind).
+  std::map<int, MMIOFunc> MMIOFuncs;
+  // Directories of the MMIO functions.
+  DirTree Dirs;
+};
+
+#endif // LLVM_TUTOR_UNIONCALLGRAPH_H
@@ -0,0 +1,96 @@
+//==============================================================================
+// FILE:
+//    CallGraphCSR.cpp
+//
+// DESCRIPTION:
+//    Builds the forward and reverse CSR adjacency of a call graph from an
+//    edge list.
+//
+// License: MIT
+//==============================================================================
+#include "CallGraphCSR.h"
+
+#include <algorithm>
+
+CallGraphCSR::CallGraphCSR(int NumNodes, std::vector<Edge> Edges)
+    : NumNodes(NumNodes) {
+  std::sort(Edges.begin(), Edges.end());
+  Edges.erase(std::unique(Edges.begin(), Edges.end()), Edges.end());
+
+  // Forward adjacency: edges are sorted by caller, so the targets can be
+  // copied in order once the offsets are known.
+  Offsets.assign(NumNodes + 1, 0);
+  ROffsets.assign(NumNodes + 1, 0);
+  for (auto &E : Edges) {
+    Offsets[E.first + 1]++;
+    ROffsets[E.second + 1]++;
+  }
+  for (int I = 0; I < NumNodes; I++) {
+    Offsets[I + 1] += Offsets[I];
+    ROffsets[I + 1] += ROffsets[I];
+  }
+
+  Targets.reserve(Edges.size());
+  for (auto &E : Edges)
+    Targets.push_back(E.second);
+
+  // Reverse adjacency: counting sort by callee. Iterating the edges in
+  // caller order keeps every predecessor list sorted.
+  RTargets.resize(Edges.size());
+  std::vector<int> Pos(ROffsets.begin(), ROffsets.end() - 1);
+  for (auto &E : Edges)
+    RTargets[Pos[E.second]++] = E.first;
+}
+
+int CallGraphCSR::computeSCCs(std::vector<int> &SCCOf) const {
+  SCCOf.assign(NumNodes, -1);
+  std::vector<int> Index(NumNodes, -1);
+  std::vector<int> LowLink(NumNodes, 0);
+  std::vector<int> SCCStack;
+  // DFS stack of (node, offset of the next successor to visit).
+  std::vector<std::pair<int, int>> DFSStack;
+  int NextIndex = 0;
+  int NumSCCs = 0;
+
+  for (int Root = 0; Root < NumNodes; Root++) {
+    if (Index[Root] != -1)
+      continue;
+    Index[Root] = LowLink[Root] = NextIndex++;
+    SCCStack.push_back(Root);
+    DFSStack.push_back({Root, Offsets[Root]});
+
+    while (!DFSStack.empty()) {
+      int U = DFSStack.back().first;
+      int Next = DFSStack.back().second;
+      if (Next < Offsets[U + 1]) {
+        DFSStack.back().second++;
+        int V = Targets[Next];
+        if (Index[V] == -1) {
+          Index[V] = LowLink[V] = NextIndex++;
+          SCCStack.push_back(V);
+          DFSStack.push_back({V, Offsets[V]});
+        } else if (SCCOf[V] == -1) {
+          // V is still on the SCC stack.
+          LowLink[U] = std::min(LowLink[U], Index[V]);
+        }
+        continue;
+      }
+
+      DFSStack.pop_back();
+      if (!DFSStack.empty()) {
+        int Parent = DFSStack.back().first;
+        LowLink[Parent] = std::min(LowLink[Parent], LowLink[U]);
+      }
+      if (LowLink[U] != Index[U])
+        continue;
+      int V;
+      do {
+        V = SCCStack.back();
+        SCCStack.pop_back();
+        SCCOf[V] = NumSCCs;
+      } while (V != U);
+      NumSCCs++;
+    }
+  }
+  return NumSCCs;
+}
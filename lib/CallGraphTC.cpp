@@ -0,0 +1,399 @@
+//==============================================================================
+// FILE:
+//    CallGraphTC.cpp
+//
+// DESCRIPTION:
+//    Transitive closure in-degree engines of FindHALBypass. The transitive
+//    closure in-degree of a node is the number of nodes from which it is
+//    reachable in the call graph, i.e. the number of its (transitive)
+//    callers.
+//      * runFloydWarshall: exact, one BFS per source
+//      * runTCExact: exact, bitset propagation over the SCC condensation
+//      * runTCBounded: exact up to a threshold, for a few query nodes only
+//      * runTCEst: Cohen's size-estimation framework, averaging the least
+//        rank reaching each node over several random rankings. The passes
+//        run in parallel and are seeded deterministically. They are computed
+//        either one BFS at a time (runTCEstOneIter) or as a k-minimum-rank
+//        sketch, many passes per traversal (runTCEstSketch).
+//
+// License: MIT
+//==============================================================================
+#include "FindHALBypass.h"
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+
+// Exact transitive closure in-degree. One BFS per source over the CSR
+// adjacency, i.e. O(V*(V+E)) time and O(V) extra space instead of the dense
+// O(V^3) closure.
+std::vector<int> FindHALBypass::runFloydWarshall(const CallGraphCSR &G) {
+  int TotNumOfCGN = G.numNodes();
+  std::vector<int> InDegrees(TotNumOfCGN, 0);
+  std::vector<int> Visited(TotNumOfCGN, -1);
+  std::vector<int> Worklist;
+  Worklist.reserve(TotNumOfCGN);
+  for (int Src = 0; Src < TotNumOfCGN; Src++) {
+    Worklist.clear();
+    Worklist.push_back(Src);
+    for (size_t Head = 0; Head < Worklist.size(); Head++) {
+      for (int V : G.succs(Worklist[Head])) {
+        if (Visited[V] == Src)
+          continue;
+        Worklist.push_back(V);
+        Visited[V] = Src;
+        InDegrees[V]++;
+      }
+    }
+  }
+  return InDegrees;
+}
+
+// Computes the SCCs of G numbered in topological order (callers first):
+// SCCOf[N] is the SCC of node N, and Members[SCCBegin[T]..SCCBegin[T+1]) are
+// the nodes of SCC T. The index of a node in Members is its position in
+// topological order. Returns the number of SCCs.
+static int condenseInTopoOrder(const CallGraphCSR &G, std::vector<int> &SCCOf,
+                               std::vector<int> &SCCBegin,
+                               std::vector<int> &Members) {
+  int TotNumOfCGN = G.numNodes();
+  int NumSCCs = G.computeSCCs(SCCOf);
+  // computeSCCs numbers the SCCs in reverse topological order.
+  for (int &SCC : SCCOf)
+    SCC = NumSCCs - 1 - SCC;
+  SCCBegin.assign(NumSCCs + 1, 0);
+  for (int SCC : SCCOf)
+    SCCBegin[SCC + 1]++;
+  for (int T = 0; T < NumSCCs; T++)
+    SCCBegin[T + 1] += SCCBegin[T];
+  Members.resize(TotNumOfCGN);
+  std::vector<int> Pos(SCCBegin.begin(), SCCBegin.end() - 1);
+  for (int N = 0; N < TotNumOfCGN; N++)
+    Members[Pos[SCCOf[N]]++] = N;
+  return NumSCCs;
+}
+
+// Exact transitive closure in-degree via SCC condensation. All nodes of an
+// SCC have the same ancestors, so ancestor sets are propagated once per SCC,
+// in topological order (callers first), as word-packed bitsets over nodes.
+// To bound memory, the source nodes are processed in chunks of at most
+// 64 * TCExactMaxWords nodes; a chunk needs one bitset of that width per SCC.
+// Nodes are laid out in topological order, so a chunk only has to be
+// propagated from the first SCC it contains onwards.
+std::vector<int> FindHALBypass::runTCExact(const CallGraphCSR &G) {
+  const int TCExactMaxWords = 64;
+  int TotNumOfCGN = G.numNodes();
+  std::vector<int> SCCOf, SCCBegin, Members;
+  int NumSCCs = condenseInTopoOrder(G, SCCOf, SCCBegin, Members);
+
+  // A node is its own ancestor iff it lies on a cycle.
+  std::vector<char> OnCycle(NumSCCs, 0);
+  for (int T = 0; T < NumSCCs; T++) {
+    if (SCCBegin[T + 1] - SCCBegin[T] > 1) {
+      OnCycle[T] = 1;
+      continue;
+    }
+    int N = Members[SCCBegin[T]];
+    for (int V : G.succs(N))
+      if (V == N)
+        OnCycle[T] = 1;
+  }
+
+  int Words = std::min(TCExactMaxWords, (TotNumOfCGN + 63) / 64);
+  int ChunkBits = Words * 64;
+  // Closed[T] = ancestors of SCC T within the chunk, plus SCC T itself.
+  std::vector<uint64_t> Closed(static_cast<size_t>(NumSCCs) * Words);
+  std::vector<uint64_t> Own(Words);
+  std::vector<int> InDegrees(TotNumOfCGN, 0);
+
+  for (int Base = 0; Base < TotNumOfCGN; Base += ChunkBits) {
+    int End = std::min(TotNumOfCGN, Base + ChunkBits);
+    int BeginT = SCCOf[Members[Base]];
+    std::fill(Closed.begin() + static_cast<size_t>(BeginT) * Words,
+              Closed.end(), 0);
+
+    for (int T = BeginT; T < NumSCCs; T++) {
+      uint64_t *Cur = &Closed[static_cast<size_t>(T) * Words];
+      for (int I = SCCBegin[T]; I < SCCBegin[T + 1]; I++) {
+        for (int P : G.preds(Members[I])) {
+          int PT = SCCOf[P];
+          if (PT == T || PT < BeginT)
+            continue;
+          const uint64_t *Pred = &Closed[static_cast<size_t>(PT) * Words];
+          for (int W = 0; W < Words; W++)
+            Cur[W] |= Pred[W];
+        }
+      }
+
+      std::fill(Own.begin(), Own.end(), 0);
+      for (int I = std::max(SCCBegin[T], Base);
+           I < std::min(SCCBegin[T + 1], End); I++)
+        Own[(I - Base) / 64] |= uint64_t(1) << ((I - Base) % 64);
+
+      int Count = 0;
+      for (int W = 0; W < Words; W++) {
+        Count += llvm::countPopulation(Cur[W]);
+        if (OnCycle[T])
+          Count += llvm::countPopulation(Own[W]);
+        Cur[W] |= Own[W];
+      }
+      for (int I = SCCBegin[T]; I < SCCBegin[T + 1]; I++)
+        InDegrees[Members[I]] += Count;
+    }
+  }
+  return InDegrees;
+}
+
+// Transitive closure in-degree of the Queries nodes, capped at Threshold.
+// Each query is a reverse BFS that stops as soon as Threshold ancestors have
+// been found. Results are memoized per SCC, since all nodes of an SCC have
+// the same ancestors. Moreover, a node reached from a node whose SCC is known
+// to have at least Threshold ancestors has at least as many ancestors itself,
+// so the search can stop there too.
+std::vector<int> FindHALBypass::runTCBounded(const CallGraphCSR &G,
+                                             llvm::ArrayRef<int> Queries,
+                                             int Threshold) {
+  int TotNumOfCGN = G.numNodes();
+  std::vector<int> SCCOf;
+  int NumSCCs = G.computeSCCs(SCCOf);
+  std::vector<int> SCCCount(NumSCCs, -1);
+  // Visited[N] == Q iff N has been counted as an ancestor in query Q.
+  std::vector<int> Visited(TotNumOfCGN, -1);
+  std::vector<int> Worklist;
+  std::vector<int> Counts;
+  Counts.reserve(Queries.size());
+
+  for (size_t Q = 0; Q < Queries.size(); Q++) {
+    int Src = Queries[Q];
+    int &Memo = SCCCount[SCCOf[Src]];
+    if (Memo != -1) {
+      Counts.push_back(Memo);
+      continue;
+    }
+
+    int Count = 0;
+    Worklist.clear();
+    Worklist.push_back(Src);
+    for (size_t Head = 0; Head < Worklist.size() && Count < Threshold;
+         Head++) {
+      for (int P : G.preds(Worklist[Head])) {
+        if (Visited[P] == static_cast<int>(Q))
+          continue;
+        Visited[P] = Q;
+        int PMemo = SCCCount[SCCOf[P]];
+        if (PMemo >= Threshold) {
+          Count = Threshold;
+          break;
+        }
+        if (++Count >= Threshold)
+          break;
+        Worklist.push_back(P);
+      }
+    }
+    Memo = std::min(Count, Threshold);
+    Counts.push_back(Memo);
+  }
+  return Counts;
+}
+
+// The ranks of pass Iter are a pure function of (Seed, Iter, Node), so
+// results do not depend on how the passes are scheduled across threads.
+static uint64_t splitMix64(uint64_t X) {
+  X += 0x9e3779b97f4a7c15ULL;
+  X = (X ^ (X >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  X = (X ^ (X >> 27)) * 0x94d049bb133111ebULL;
+  return X ^ (X >> 31);
+}
+
+// The part of the rank of a node that only depends on the pass.
+static uint64_t passKey(uint64_t Seed, uint64_t Iter) {
+  return splitMix64(splitMix64(Seed) ^ Iter);
+}
+
+static double keyRank(uint64_t PassKey, uint64_t Node) {
+  uint64_t H = splitMix64(PassKey ^ Node);
+  // Uniform in (0, 1); never 0 since the estimate divides by the ranks.
+  return (static_cast<double>(H >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double counterRank(uint64_t Seed, uint64_t Iter, uint64_t Node) {
+  return keyRank(passKey(Seed, Iter), Node);
+}
+
+// With K passes, the least rank reaching a node with N ancestors (itself
+// included) sums to roughly a Gamma(K, N) variable, so K/Sum estimates N
+// with a relative standard error of about 1/sqrt(K).
+static bool straddlesThreshold(const std::vector<double> &RankLeastSum,
+                               unsigned NumOfIter, const TCEstOptions &Opts) {
+  const double Z = 1.96;
+  double RelErr = Z / std::sqrt(static_cast<double>(NumOfIter));
+  for (int Q : Opts.Queries) {
+    double Est = NumOfIter / RankLeastSum[Q];
+    double Lo = Est * (1 - RelErr) - 1;
+    double Hi = Est * (1 + RelErr) - 1;
+    if (Lo < Opts.Threshold && Hi >= Opts.Threshold)
+      return true;
+  }
+  return false;
+}
+
+// Lanes propagated together by runTCEstSketch.
+static const unsigned SketchLanes = 64;
+
+std::vector<int> FindHALBypass::runTCEst(const CallGraphCSR &G,
+                                         const TCEstOptions &Opts) {
+  int TotNumOfCGN = G.numNodes();
+  unsigned BatchSize = std::max(1u, Opts.NumIter);
+  std::vector<double> RankLeastSum(TotNumOfCGN, 0.0);
+  std::vector<int> InDegrees(TotNumOfCGN);
+  std::vector<std::vector<double>> Batch(BatchSize);
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(Opts.NumThreads));
+  // The blocks of lanes of every batch share one condensation of G.
+  Condensation C;
+  if (Opts.Backend == TCEstBackend::Sketch)
+    C.NumSCCs = condenseInTopoOrder(G, C.SCCOf, C.SCCBegin, C.Members);
+  unsigned NumOfIter = 0;
+  do {
+    if (Opts.Backend == TCEstBackend::Sketch) {
+      // One task per block of lanes; Batch[B] holds the block's rank sums.
+      unsigned NumBlocks = (BatchSize + SketchLanes - 1) / SketchLanes;
+      Batch.resize(NumBlocks);
+      for (unsigned B = 0; B < NumBlocks; B++) {
+        unsigned FirstIter = NumOfIter + B * SketchLanes;
+        unsigned NumLanes = std::min(SketchLanes, BatchSize - B * SketchLanes);
+        Pool.async([&G, &C, &Batch, &Opts, B, FirstIter, NumLanes] {
+          Batch[B] = runTCEstSketch(G, C, Opts.Seed, FirstIter, NumLanes);
+        });
+      }
+    } else {
+      for (unsigned I = 0; I < BatchSize; I++) {
+        unsigned Iter = NumOfIter + I;
+        Pool.async([&G, &Batch, &Opts, I, Iter] {
+          Batch[I] = runTCEstOneIter(G, Opts.Seed, Iter);
+        });
+      }
+    }
+    Pool.wait();
+    // Reduce in pass order: floating-point addition is not associative.
+    for (auto &RankLeast : Batch)
+      std::transform(RankLeast.begin(), RankLeast.end(), RankLeastSum.begin(),
+                     RankLeastSum.begin(), std::plus<double>());
+    NumOfIter += BatchSize;
+  } while (Opts.Adaptive && NumOfIter < Opts.MaxIter &&
+           straddlesThreshold(RankLeastSum, NumOfIter, Opts));
+
+  std::transform(RankLeastSum.begin(), RankLeastSum.end(), InDegrees.begin(),
+                 [NumOfIter](double s) {
+                   return std::round(NumOfIter / s) - 1;
+                 });
+  return InDegrees;
+}
+
+// Computes, for every node, the least rank among the nodes that reach it
+// (itself included). Sources are processed in increasing rank order and a
+// BFS never enters a node that was already visited, since an earlier BFS
+// has already assigned it a smaller rank. Every node is therefore enqueued
+// exactly once and every edge scanned at most once: one pass is O(V+E) plus
+// the O(V log V) rank sort.
+std::vector<double> FindHALBypass::runTCEstOneIter(const CallGraphCSR &G,
+                                                   uint64_t Seed,
+                                                   unsigned Iter) {
+  int TotNumOfCGN = G.numNodes();
+  std::vector<double> Rank(TotNumOfCGN);
+  for (int I = 0; I < TotNumOfCGN; I++)
+    Rank[I] = counterRank(Seed, Iter, I);
+  std::vector<int> Order(TotNumOfCGN);
+  std::iota(Order.begin(), Order.end(), 0);
+  std::sort(Order.begin(), Order.end(),
+            [&Rank](int LHS, int RHS) { return Rank[LHS] < Rank[RHS]; });
+
+  std::vector<double> RankLeast(TotNumOfCGN, 0.0);
+  std::vector<char> Visited(TotNumOfCGN, 0);
+  // Shared by all BFSs: the total number of pushes is bounded by V.
+  std::vector<int> Worklist;
+  Worklist.reserve(TotNumOfCGN);
+  for (int Src : Order) {
+    if (Visited[Src])
+      continue;
+    double SrcRank = Rank[Src];
+    Worklist.clear();
+    Worklist.push_back(Src);
+    Visited[Src] = 1;
+    RankLeast[Src] = SrcRank;
+
+    for (size_t Head = 0; Head < Worklist.size(); Head++) {
+      for (int V : G.succs(Worklist[Head])) {
+        if (Visited[V])
+          continue;
+        Worklist.push_back(V);
+        Visited[V] = 1;
+        RankLeast[V] = SrcRank;
+      }
+    }
+  }
+  return RankLeast;
+}
+
+// Computes passes FirstIter..FirstIter+NumLanes-1 at once and returns, for
+// every node, the sum over these passes of the least rank reaching it. This
+// is the sum of what runTCEstOneIter returns for each of these passes (up to
+// float rounding): the ranks are the same, only the traversal differs.
+//
+// Each SCC keeps one least rank per lane, laid out contiguously. The lanes
+// are first filled with the least rank of the SCC's own nodes; the part of
+// the rank hash that only depends on the pass is computed once per lane.
+// SCCs are then visited in topological order (callers first) and take the
+// lane-wise minimum of their callers' lanes, so all lanes cost a single
+// traversal of the condensation C of G, and its inner loop is a plain
+// element-wise minimum over float arrays, which the compiler vectorizes.
+std::vector<double> FindHALBypass::runTCEstSketch(const CallGraphCSR &G,
+                                                  const Condensation &C,
+                                                  uint64_t Seed,
+                                                  unsigned FirstIter,
+                                                  unsigned NumLanes) {
+  int TotNumOfCGN = G.numNodes();
+  int NumSCCs = C.NumSCCs;
+  const std::vector<int> &SCCOf = C.SCCOf, &SCCBegin = C.SCCBegin,
+                         &Members = C.Members;
+
+  std::vector<uint64_t> PassKeys(NumLanes);
+  for (unsigned K = 0; K < NumLanes; K++)
+    PassKeys[K] = passKey(Seed, FirstIter + K);
+  std::vector<float> MinRank(static_cast<size_t>(NumSCCs) * NumLanes, 1.0f);
+  for (int T = 0; T < NumSCCs; T++) {
+    float *Cur = &MinRank[static_cast<size_t>(T) * NumLanes];
+    for (int I = SCCBegin[T]; I < SCCBegin[T + 1]; I++) {
+      int N = Members[I];
+      for (unsigned K = 0; K < NumLanes; K++) {
+        float R = keyRank(PassKeys[K], N);
+        Cur[K] = R < Cur[K] ? R : Cur[K];
+      }
+    }
+  }
+
+  std::vector<double> RankLeastSum(TotNumOfCGN, 0.0);
+  for (int T = 0; T < NumSCCs; T++) {
+    float *Cur = &MinRank[static_cast<size_t>(T) * NumLanes];
+    for (int I = SCCBegin[T]; I < SCCBegin[T + 1]; I++) {
+      int N = Members[I];
+      for (int P : G.preds(N)) {
+        int PT = SCCOf[P];
+        if (PT == T)
+          continue;
+        const float *Pred = &MinRank[static_cast<size_t>(PT) * NumLanes];
+        for (unsigned K = 0; K < NumLanes; K++)
+          Cur[K] = Pred[K] < Cur[K] ? Pred[K] : Cur[K];
+      }
+    }
+
+    double Sum = 0.0;
+    for (unsigned K = 0; K < NumLanes; K++)
+      Sum += Cur[K];
+    for (int I = SCCBegin[T]; I < SCCBegin[T + 1]; I++)
+      RankLeastSum[Members[I]] = Sum;
+  }
+  return RankLeastSum;
+}
@@ -0,0 +1,124 @@
+//==============================================================================
+// FILE:
+//    DirTree.cpp
+//
+// DESCRIPTION:
+//    Trie of source directories (see DirTree.h).
+//
+// License: MIT
+//==============================================================================
+#include "DirTree.h"
+
+#include "llvm/ADT/STLExtras.h"
+
+using namespace llvm;
+
+// Node of "/".
+static const unsigned AbsRoot = 2;
+
+DirTree::DirTree() : Saver(Alloc) {
+  Nodes.push_back({0, 0, "", Mark::None, Stats()});
+  Nodes.push_back({getRoot(), 1, "<none>", Mark::None, Stats()});
+  Nodes.push_back({getRoot(), 1, "/", Mark::None, Stats()});
+}
+
+unsigned DirTree::insert(StringRef Dir) {
+  if (Dir.empty())
+    return getNoDir();
+  unsigned N = Dir.startswith("/") ? AbsRoot : getRoot();
+  while (!Dir.empty()) {
+    StringRef Component;
+    std::tie(Component, Dir) = Dir.split('/');
+    if (Component.empty())
+      continue;
+    auto It = Children.find({N, Component});
+    if (It != Children.end()) {
+      N = It->second;
+      continue;
+    }
+    unsigned Child = size();
+    StringRef Name = Saver.save(Component);
+    Nodes.push_back({N, Nodes[N].Depth + 1, Name, Mark::None, Stats()});
+    Children[{N, Name}] = Child;
+    N = Child;
+  }
+  return N;
+}
+
+std::string DirTree::getPath(unsigned N) const {
+  if (getDepth(N) <= 1)
+    return Nodes[N].Name.str();
+  std::vector<StringRef> Components;
+  for (; getDepth(N) > 1; N = getParent(N))
+    Components.push_back(Nodes[N].Name);
+  // N is "/" or a top relative directory.
+  std::string Path = N == AbsRoot ? "" : Nodes[N].Name.str();
+  for (StringRef Component : llvm::reverse(Components)) {
+    Path += '/';
+    Path += Component;
+  }
+  return Path;
+}
+
+unsigned DirTree::getCommonAncestor(unsigned A, unsigned B) const {
+  while (getDepth(A) > getDepth(B))
+    A = getParent(A);
+  while (getDepth(B) > getDepth(A))
+    B = getParent(B);
+  while (A != B) {
+    A = getParent(A);
+    B = getParent(B);
+  }
+  return A;
+}
+
+unsigned DirTree::getAncestor(unsigned N, unsigned Depth) const {
+  while (getDepth(N) > Depth)
+    N = getParent(N);
+  return N;
+}
+
+void DirTree::markHal(unsigned N, bool Subtree) {
+  if (Subtree)
+    Nodes[N].HalMark = Mark::Subtree;
+  else if (Nodes[N].HalMark == Mark::None)
+    Nodes[N].HalMark = Mark::Dir;
+}
+
+bool DirTree::isHal(unsigned N) const {
+  if (Nodes[N].HalMark != Mark::None)
+    return true;
+  while (N != getRoot()) {
+    N = getParent(N);
+    if (Nodes[N].HalMark == Mark::Subtree)
+      return true;
+  }
+  return false;
+}
+
+void DirTree::rollUp() {
+  for (unsigned N = size() - 1; N > getRoot(); N--) {
+    const Stats &S = Nodes[N].S;
+    Stats &P = Nodes[getParent(N)].S;
+    P.NumFuncs += S.NumFuncs;
+    P.NumOverThreshold += S.NumOverThreshold;
+    P.NumNCMA_CG += S.NumNCMA_CG;
+    P.MaxTC = std::max(P.MaxTC, S.MaxTC);
+  }
+}
+
+void DirTree::writeRollup(raw_ostream &OS) const {
+  std::vector<std::pair<std::string, unsigned>> Rows;
+  for (unsigned N = getRoot() + 1; N < size(); N++)
+    if (Nodes[N].S.NumFuncs)
+      Rows.push_back({getPath(N), N});
+  llvm::sort(Rows);
+  OS << "# Directory, MMIO functions, Over threshold, NCMA(CG), Max TC "
+        "In-degree, HAL\n";
+  for (auto &Row : Rows) {
+    const Stats &S = Nodes[Row.second].S;
+    OS << Row.first << " " << S.NumFuncs << " " << S.NumOverThreshold << " "
+       << S.NumNCMA_CG << " " << S.MaxTC << " " << unsigned(isHal(Row.second))
+       << "\n";
+  }
+}
@@ -24,68 +24,326 @@
 //
 // License: MIT
 //==============================================================================
-#if 0
-/* Already defined in commandline */
-#define _GNU_SOURCE /* memrchr() */
-#endif
-#include <unistd.h>
-
 #include "FindHALBypass.h"
-
-#include "llvm/Analysis/CallGraph.h"
+#include "FunctionSummary.h"
+#include "HalRules.h"
+#include "HalSnapshot.h"
+#include "PeripheralIndex.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/AbstractCallSite.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
 #include <algorithm>
-#include <regex>
-#include <random>
-#include <queue>
-#include <set>
+#include <chrono>
 #include <cmath>
-#include <climits>
-#include <cstdlib>
-#include <cstring>
+#include <mutex>
 
 using namespace llvm;
 
-// Pretty-prints the result of this analysis
-static void printHALBypassResult(llvm::raw_ostream &OutS,
-                                 const FindHALBypass::Result &);
-static std::string resolvePath(StringRef Dir, StringRef Filename);
+enum class TCEngine { Estimate, Exact, Bounded, BFS };
+
+static cl::opt<TCEngine> TCEngineOpt(
+    "hal-tc-engine",
+    cl::desc("Engine computing the transitive closure in-degree of call "
+             "graph nodes"),
+    cl::values(clEnumValN(TCEngine::Estimate, "estimate",
+                          "Randomized size estimation (default)"),
+               clEnumValN(TCEngine::Exact, "exact",
+                          "Exact, bitset propagation over SCCs"),
+               clEnumValN(TCEngine::Bounded, "bounded",
+                          "Exact up to -hal-tc-threshold, only for MMIO "
+                          "functions"),
+               clEnumValN(TCEngine::BFS, "bfs",
+                          "Exact, one BFS per node (slow)")),
+    cl::init(TCEngine::Estimate));
+
+static cl::opt<int> HalTCThreshold(
+    "hal-tc-threshold",
+    cl::desc("Transitive closure in-degree from which the directory of an "
+             "MMIO function is considered a HAL directory"),
+    cl::init(10));
+
+static cl::opt<unsigned> HalSubtreeDepth(
+    "hal-subtree-depth",
+    cl::desc("Make a HAL directory mark its whole subtree at this depth "
+             "below the common directory of the MMIO functions (0 = only "
+             "the directory itself)"),
+    cl::init(0));
+
+static cl::opt<std::string> HalDirRollupFile(
+    "hal-dir-rollup",
+    cl::desc("Write per-directory-subtree statistics of the MMIO functions"),
+    cl::value_desc("filename"));
+
+static cl::opt<TCEstBackend> TCEstBackendOpt(
+    "hal-tc-est-backend",
+    cl::desc("How the passes of the transitive closure in-degree estimator "
+             "are computed"),
+    cl::values(clEnumValN(TCEstBackend::BFS, "bfs",
+                          "One rank-ordered BFS per pass (default)"),
+               clEnumValN(TCEstBackend::Sketch, "sketch",
+                          "Up to 64 passes per traversal, as min-rank "
+                          "sketch lanes")),
+    cl::init(TCEstBackend::BFS));
+
+static cl::opt<unsigned> TCEstIters(
+    "hal-tc-est-iters",
+    cl::desc("Number of passes of the transitive closure in-degree estimator "
+             "(per batch with -hal-tc-est-adaptive)"),
+    cl::init(10));
+
+static cl::opt<uint64_t> TCEstSeed(
+    "hal-tc-est-seed",
+    cl::desc("Seed of the transitive closure in-degree estimator"),
+    cl::init(0));
+
+cl::opt<unsigned> TCEstThreads(
+    "hal-tc-est-threads",
+    cl::desc("Threads running estimator passes (0 = all hardware threads)"),
+    cl::init(0));
+
+cl::opt<bool> HalAnalysisTime(
+    "hal-analysis-time",
+    cl::desc("Print the number of call graph nodes and the analysis time of "
+             "each module"),
+    cl::init(true));
+
+static cl::opt<bool> TCEstAdaptive(
+    "hal-tc-est-adaptive",
+    cl::desc("Add estimator passes until no MMIO function's confidence "
+             "interval straddles -hal-tc-threshold"),
+    cl::init(false));
+
+static cl::opt<unsigned> TCEstMaxIters(
+    "hal-tc-est-max-iters",
+    cl::desc("Maximum number of passes with -hal-tc-est-adaptive"),
+    cl::init(320));
+
+static void printDebugLoc(raw_ostream &OS, const DebugLoc &DL,
+                          StringRef Path);
+
+static cl::opt<std::string> HalSnapshotFile(
+    "hal-snapshot",
+    cl::desc("Write the call graph and MMIO functions to a binary snapshot "
+             "(see HalSnapshot.h)"),
+    cl::value_desc("filename"));
+
+// Pretty-prints the result of this analysis (a FindHALBypass::Result or
+// report entries)
+template <typename ResultT>
+static void printHALBypassResult(llvm::raw_ostream &OutS, const ResultT &);
+// Writes one JSON object per MMIO function and line
+template <typename ResultT>
+static void printHALBypassJSONL(llvm::raw_ostream &OutS, const ResultT &);
 
 //------------------------------------------------------------------------------
 // FindHALBypass Implementation
 //------------------------------------------------------------------------------
+FindHALBypass::Result FindHALBypass::runOnModule(Module &M) {
+  FlatCallGraph CG(M);
+  FindMMIOFunc::Result MMIOFuncs = FindMMIOFunc().runOnModule(M, &CG);
+  CG.resolveIndirectCalls();
+  return runOnCallGraph(CG, MMIOFuncs);
+}
+
+// Whether anything could call local function F, as decided by CallGraph.
+static bool isAddressTaken(const Function &F) {
+  return F.hasAddressTaken(nullptr, /*IgnoreCallbackUses=*/true,
+                           /*IgnoreAssumeLikeCalls=*/true,
+                           /*IgnoreLLVMUsed=*/false);
+}
+
+// Functions used by the instructions of F, directly or through constants.
+static SmallPtrSet<const Function *, 16> getReferencedFunctions(Function &F) {
+  SmallPtrSet<const Function *, 16> Functions;
+  SmallPtrSet<const Constant *, 16> Visited;
+  SmallVector<const Constant *, 16> Worklist;
+  for (Instruction &I : instructions(F))
+    for (const Value *Op : I.operands())
+      if (auto *C = dyn_cast<Constant>(Op))
+        if (Visited.insert(C).second)
+          Worklist.push_back(C);
+  while (!Worklist.empty()) {
+    const Constant *C = Worklist.pop_back_val();
+    if (auto *Fn = dyn_cast<Function>(C)) {
+      Functions.insert(Fn);
+      continue;
+    }
+    if (isa<GlobalValue>(C))
+      continue;
+    for (const Value *Op : C->operands())
+      if (Visited.insert(cast<Constant>(Op)).second)
+        Worklist.push_back(cast<Constant>(Op));
+  }
+  return Functions;
+}
+
+// Adds the edges recorded in the summary of M to CG. Functions referenced
+// by a summary (other than as callees) have their address taken, so they
+// are callable from outside. The summary has no indirect calls, which only
+// lead to the calls-external node, nor calls to intrinsics.
+static void addSummaryEdges(FlatCallGraph &CG, Module &M,
+                            const ModuleSummaryIndex &Index,
+                            SmallPtrSetImpl<const Function *> &CallableFromOutside) {
+  DenseMap<GlobalValue::GUID, Function *> Functions;
+  for (Function &F : M)
+    Functions[F.getGUID()] = &F;
+  for (const auto &Entry : Index) {
+    Function *Caller = Functions.lookup(Entry.first);
+    for (const auto &Summary : Entry.second.SummaryList) {
+      for (ValueInfo Ref : Summary->refs()) {
+        Function *F = Functions.lookup(Ref.getGUID());
+        if (F && F->hasLocalLinkage() && CallableFromOutside.insert(F).second)
+          CG.addEdge(CG.externalCallingNode(), CG.getNode(F));
+      }
+      auto *FS = dyn_cast<llvm::FunctionSummary>(Summary.get());
+      if (!FS || !Caller)
+        continue;
+      for (const llvm::FunctionSummary::EdgeTy &Call : FS->calls())
+        if (Function *Callee = Functions.lookup(Call.first.getGUID()))
+          CG.addEdge(CG.getNode(Caller), CG.getNode(Callee));
+    }
+  }
+}
+
+// With -hal-analysis-time, prints the time since Start. Modules may be
+// analyzed on several threads (see halvd), so the line is written whole
+// under a lock.
+static void
+printAnalysisTime(int NumNodes,
+                  std::chrono::high_resolution_clock::time_point Start) {
+  static std::mutex Mutex;
+  if (!HalAnalysisTime)
+    return;
+  auto Duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::high_resolution_clock::now() - Start);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  dbgs() << "# of Node vs. Analysis time: " << NumNodes << " "
+         << Duration.count() << "\n";
+}
+
+Error FindHALBypass::runOnLazyModule(
+    Module &M, Result &Res, const ModuleSummaryIndex *Index,
+    const DenseSet<GlobalValue::GUID> *Candidates) {
+  auto Start = std::chrono::high_resolution_clock::now();
+  FlatCallGraph CG(M);
+  FindMMIOFunc::Result MMIOFuncs;
+  if (Error E = scanLazyModule(M, CG, MMIOFuncs, Index, Candidates))
+    return E;
+  Res = runOnCallGraph(CG, MMIOFuncs);
+  printAnalysisTime(CGNumOfNodes, Start);
+  return Error::success();
+}
+
+Error FindHALBypass::scanLazyModule(
+    Module &M, FlatCallGraph &CG, FindMMIOFunc::Result &MMIOFuncs,
+    const ModuleSummaryIndex *Index,
+    const DenseSet<GlobalValue::GUID> *Candidates) {
+  // The summary has neither the indirect calls nor the functions stored at
+  // run time.
+  if (Index && FlatCallGraph::resolvesIndirectCalls())
+    return createStringError(inconvertibleErrorCode(),
+                             "-hal-indirect-calls needs the function bodies, "
+                             "not a summary");
+  // Without the bodies, the call graph only has its nodes and the edges from
+  // the external calling node to the functions it can already tell are
+  // externally callable. The other edges come from the summary or are added
+  // as the bodies are read.
+  SmallPtrSet<const Function *, 16> CallableFromOutside;
+  for (const Function &F : M)
+    if (F.hasLocalLinkage() && isAddressTaken(F))
+      CallableFromOutside.insert(&F);
+  if (Index)
+    addSummaryEdges(CG, M, *Index, CallableFromOutside);
+
+  FindMMIOFunc MMIOScan;
+  std::vector<const Instruction *> Sites;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    // The summary has the call edges: only the MMIO bodies are needed.
+    if (Index && Candidates && !Candidates->count(F.getGUID()))
+      continue;
+    if (Error E = F.materialize())
+      return E;
+    if (!Index) {
+      // F's body may hold the only address-taking uses of a local function,
+      // and they go away with the body: check the functions it references.
+      for (const Function *Referenced : getReferencedFunctions(F)) {
+        if (!Referenced->hasLocalLinkage() ||
+            CallableFromOutside.count(Referenced) ||
+            !isAddressTaken(*Referenced))
+          continue;
+        CallableFromOutside.insert(Referenced);
+        CG.addEdge(CG.externalCallingNode(), CG.getNode(Referenced));
+      }
+    }
+    if (!MMIOScan.addFunction(F, MMIOFuncs, Sites, Index ? nullptr : &CG))
+      F.deleteBody();
+  }
+  FindMMIOFunc::buildSiteTable(MMIOFuncs, Sites);
+  CG.resolveIndirectCalls();
+  return Error::success();
+}
+
 FindHALBypass::Result
-FindHALBypass::runOnModule(Module &M, const FindMMIOFunc::Result &MMIOFuncs) {
+FindHALBypass::runOnCallGraph(FlatCallGraph &CG,
+                              const FindMMIOFunc::Result &MMIOFuncs) {
   MMIOFuncMap.clear();
+  MMIOFuncMap.Paths = std::make_shared<PathTable>();
+  MMIOFuncMap.Sites = MMIOFuncs.Sites;
   for (auto &Node : MMIOFuncs) {
     const Function *F = Node.first;
-    MMIOFunc MF = MMIOFunc(Node.second, F);
+    MMIOFunc MF = MMIOFunc(Node.second, F, *MMIOFuncMap.Paths);
     MMIOFuncMap.insert({F, MF});
   }
-  CallGraph CG = CallGraph(M);
   callGraphBasedHalIdent(CG);
+  if (!HalSnapshotFile.empty())
+    writeSnapshot(HalSnapshotFile);
 
   return MMIOFuncMap;
 }
 
+// The result holds no FindMMIOFunc result: it runs its own scan (see
+// runOnModule), so it only depends on the IR.
+bool FindHALBypass::Result::invalidate(Module &, const PreservedAnalyses &PA,
+                                       ModuleAnalysisManager::Invalidator &) {
+  return FindMMIOFunc::isInvalidated(FindHALBypass::ID(), PA);
+}
+
 FindHALBypass::MMIOFunc::MMIOFunc(const FindMMIOFunc::MMIOFunc &Parent,
-                                  const Function *F)
+                                  const Function *F, PathTable &Paths)
     : FindMMIOFunc::MMIOFunc(Parent), F(F), IsHalPattern(false), NCMA_CG(false),
-      InDegree(0), TransClosureInDeg(0) {
+      NCMA_GroundTruth(false), InDegree(0), TransClosureInDeg(0),
+      LocFileID(-1) {
+  if (const DebugLoc &DL = MMIOIns->getDebugLoc())
+    LocFileID = Paths.getFileID(cast<DIScope>(DL.getScope())->getFile());
   DISubprogram *DISub = F->getSubprogram();
-  if (!DISub) return;
-  DIFile *File = DISub->getFile();
-  std::string Filename(File->getFilename());
-  std::string Dir(File->getDirectory());
-  //FullPath = Dir + "/" + Filename;
-  FullPath = resolvePath(File->getDirectory(), File->getFilename());
-  size_t Found = FullPath.find_last_of("/\\");
-  Dirname = FullPath.substr(0, Found);
-  isHalPattern();
-}
-
-void FindHALBypass::MMIOFunc::isHalPattern() {
+  if (!DISub) {
+    FileID = DirID = Paths.intern("");
+    return;
+  }
+  FileID = Paths.getFileID(DISub->getFile());
+  DirID = Paths.getDirID(FileID);
+  signed char Cached = Summary ? Summary->GroundTruth.load() : -1;
+  if (Cached >= 0) {
+    NCMA_GroundTruth = Cached;
+    return;
+  }
+  isHalPattern(Paths.getPath(FileID));
+  if (Summary)
+    Summary->GroundTruth = NCMA_GroundTruth;
+}
+
+void FindHALBypass::MMIOFunc::isHalPattern(StringRef FullPath) {
   DISubprogram *DISub = F->getSubprogram();
   if (!DISub) {
     errs() << "Warning: isHalFunc: DISubprogram not exists.\n";
@@ -105,57 +363,96 @@ void FindHALBypass::MMIOFunc::isHalPattern() {
     //                << LinkageName << " " << FullPath << "\n");
 }
 
-bool FindHALBypass::MMIOFunc::isHalPatternInternal(std::string Name, bool Full) {
-  std::regex ProjRe("Amazfitbip-FreeRTOS|RP2040-FreeRTOS|"
-                    "(blockingmqtt|dualport|ipcommdevice)_freertos");
-  Name = std::regex_replace(Name, ProjRe, "");
-
-  std::string HalReStr =
-    "(?!.*zephyr/samples)" // Does not contain "zephyr/samples"
-    "(?!.*hal_examples)" // Does not contain "hal_examples"
-    ".*(^|[^[:alpha:]])" // Word boundary
-    "(hal|drivers?|cmsis|arch|soc|boards?|irq|isr"
-    "|port(able)?|spi|hardware|timer|nvic"
-    "";
-  if (Full) {
-    HalReStr +=
-    // below are project-specific patterns
-    "|npl"  // NimBLE Porting Layer (NPL)
-    "|nrfx"  // peripheral drivers for Nordic SoCs
-    "|libopencm3"
-    "|zephyr/subsys/bluetooth/controller"
-    "|mbed-os/targets"
-    //"|mbed-os/platform"
-    "|avm"  // Avem/libs/module/avm_*.[ch]
-    "|plo/devices" // phoenix-rtos
-    "|esp-idf/components/(esp_hw_support|esp_system|bootloader_support|"
-    "esp_phy|esp_timer|ulp|esp_psram|esp_rom)"
-    "|system_stm32f4xx\\.c"  // STM32_BASE
-    // Debug purpose
-    //"|print_context_info" // mbed
-    //"|nx_start_application" // nuttx
-    "";
+HALBypassReportEntry
+FindHALBypass::MMIOFunc::getReportEntry(const PathTable &Paths,
+                                        const MMIOSiteTable &Sites) const {
+  HALBypassReportEntry Entry;
+  Entry.Name = F->getName().str();
+  const DebugLoc &DL = MMIOIns->getDebugLoc();
+  if (LocFileID >= 0)
+    Entry.File = Paths.getPath(LocFileID).str();
+  Entry.Line = DL ? DL.getLine() : 0;
+  Entry.Col = DL ? DL.getCol() : 0;
+  raw_string_ostream OS(Entry.Loc);
+  printDebugLoc(OS, DL, Entry.File);
+  OS.flush();
+  Entry.TransClosureInDeg = TransClosureInDeg;
+  Entry.NCMA_CG = NCMA_CG;
+  Entry.NCMA_GroundTruth = NCMA_GroundTruth;
+  Entry.MacroUsed = MacroUsed;
+  Entry.NumSites = NumSites;
+  Entry.MinAddr = MinAddr;
+  Entry.MaxAddr = MaxAddr;
+  const PeripheralIndex *Index = PeripheralIndex::get();
+  if (!Index)
+    return Entry;
+  // Sites without a known address count as accessing no peripheral.
+  auto getName = [&](int ID, bool IsRegister) -> std::string {
+    if (ID < 0)
+      return "";
+    return (IsRegister ? Index->getRegisterName(ID)
+                       : Index->getPeripheralName(ID))
+        .str();
+  };
+  std::map<std::pair<std::string, std::string>, unsigned> Counts;
+  for (size_t I = FirstSite; I < FirstSite + NumSites; I++) {
+    PeripheralIndex::Match M = Sites.hasAddress(I)
+                                   ? Index->lookup(Sites.getAddress(I))
+                                   : PeripheralIndex::Match();
+    std::pair<std::string, std::string> Key = {getName(M.Peripheral, false),
+                                               getName(M.Register, true)};
+    // MMIOIns is the first site.
+    if (I == FirstSite) {
+      Entry.Peripheral = Key.first;
+      Entry.Register = Key.second;
+    }
+    Counts[Key]++;
   }
-  HalReStr += ")($|[^[:alpha:]]).*";
-  return std::regex_match(Name, std::regex(HalReStr, std::regex::icase));
+  for (auto &C : Counts)
+    Entry.Accesses.push_back({C.first.first, C.first.second, C.second});
+  return Entry;
+}
+
+std::string FindHALBypass::getConfigKey() {
+  std::string Key;
+  raw_string_ostream OS(Key);
+  OS << "v" << ResultVersion << " llvm-" << LLVM_VERSION_STRING
+     << " engine=" << static_cast<int>(TCEngineOpt.getValue())
+     << " threshold=" << HalTCThreshold
+     << " subtree-depth=" << HalSubtreeDepth
+     << " est-backend=" << static_cast<int>(TCEstBackendOpt.getValue())
+     << " est-iters=" << TCEstIters << " est-seed=" << TCEstSeed
+     << " est-adaptive=" << TCEstAdaptive
+     << " est-max-iters=" << TCEstMaxIters << " "
+     << FlatCallGraph::getConfigKey()
+     << " rules=" << HalRules::get().getHash();
+  if (const PeripheralIndex *Index = PeripheralIndex::get())
+    OS << " svd=" << Index->getHash();
+  return OS.str();
 }
 
-void FindHALBypass::callGraphBasedHalIdent(llvm::CallGraph &CG) {
+// Patterns are the strip, hal-exclude, hal and (if Full) hal-project rules
+bool FindHALBypass::MMIOFunc::isHalPatternInternal(StringRef Name, bool Full) {
+  return HalRules::get().isHalName(Name, Full);
+}
+
+void FindHALBypass::callGraphBasedHalIdent(FlatCallGraph &CG) {
   computeCallGraphInDeg(CG);
   computeCallGraphTCInDeg(CG);
-  std::set<std::string> HalDirs;
+  DirTree Tree;
+  std::vector<int> DirNodes(MMIOFuncMap.Paths->size(), -1);
+  std::vector<DirRuleFunc> Funcs;
   for (auto &I : MMIOFuncMap) {
-    I.second.NCMA_CG = !I.second.MacroUsed;
-    //if (I.second.TransClosureInDeg >= CallGraphTCInDegPctl(75.0)) {
-    if (I.second.TransClosureInDeg >= 10) {
-      HalDirs.insert(I.second.Dirname);
-    }
-  }
-  for (auto &I : MMIOFuncMap) {
-    if (HalDirs.find(I.second.Dirname) != HalDirs.end() ) {
-      I.second.NCMA_CG = false;
-    }
+    int &Dir = DirNodes[I.second.DirID];
+    if (Dir < 0)
+      Dir = Tree.insert(MMIOFuncMap.Paths->getPath(I.second.DirID));
+    Funcs.push_back({static_cast<unsigned>(Dir), I.second.TransClosureInDeg,
+                     I.second.MacroUsed, false});
   }
+  applyHalDirRule(Tree, Funcs);
+  size_t F = 0;
+  for (auto &I : MMIOFuncMap)
+    I.second.NCMA_CG = Funcs[F++].NCMA_CG;
 //  auto CntTruePos = std::count_if(MMIOFuncMap.begin(), MMIOFuncMap.end(),
 //      [](auto &I) { return I.second.IsHal && I.second.IsHal2; });
 //  auto CntSelected = std::count_if(MMIOFuncMap.begin(), MMIOFuncMap.end(),
@@ -181,147 +478,166 @@ void FindHALBypass::callGraphBasedHalIdent(llvm::CallGraph &CG) {
 //         << "\n";
 }
 
-void FindHALBypass::computeCallGraphTCInDeg(llvm::CallGraph &CG) {
-  //CG.dump();
-  std::map<CallGraphNode *, int> CGN2Num;
-  int TotNumOfCGN= 0;
+void FindHALBypass::computeCallGraphTCInDeg(FlatCallGraph &CG) {
+  CGNumOfNodes = CG.numNodes();
+  CGNumOfEdges = static_cast<int>(CG.edges().size());
+  CallGraphCSR G(CG.numNodes(), CG.takeEdges());
+
+  // The MMIO functions are the only nodes whose in-degree is used.
+  std::vector<int> Queries;
+  for (auto &I : MMIOFuncMap)
+    Queries.push_back(CG.getNode(I.first));
+
+  std::vector<int> InDegrees = computeTCInDegrees(G, Queries);
+  size_t Q = 0;
+  for (auto &I : MMIOFuncMap)
+    I.second.TransClosureInDeg = InDegrees[Queries[Q++]];
+
+  if (!HalSnapshotFile.empty()) {
+    GraphFuncs.resize(CG.numNodes());
+    for (int N = 0; N < CG.numNodes(); N++)
+      GraphFuncs[N] = CG.getFunction(N);
+    Graph = std::move(G);
+  }
+}
 
-  for (auto &I : CG) {
-    CGN2Num[I.second.get()] = TotNumOfCGN++;
+void FindHALBypass::writeSnapshot(StringRef Path) {
+  // The calls-external node is numbered last.
+  std::vector<StringRef> NodeNames;
+  DenseMap<const Function *, unsigned> Nodes;
+  for (unsigned N = 0; N < GraphFuncs.size(); N++) {
+    const Function *F = GraphFuncs[N];
+    NodeNames.push_back(F ? F->getName()
+                          : N + 1 == GraphFuncs.size() ? "<calls external>"
+                                                       : "<external>");
+    if (F)
+      Nodes[F] = N;
   }
-  CGN2Num[CG.getCallsExternalNode()] = TotNumOfCGN++;
-  std::vector<int> AdjMatrix(TotNumOfCGN * TotNumOfCGN, 0);
-
-  int NumOfEdges = 0;
-  for (auto &I : CG) {
-    //const Function *Caller = I.first;
-    CallGraphNode *Caller = I.second.get();
-    for (auto &J : *I.second) {
-      //const Function *Callee = J.second->getFunction();
-      CallGraphNode *Callee = J.second;
-      AdjMatrix[CGN2Num.at(Caller) * TotNumOfCGN + CGN2Num.at(Callee)] = 1;
-      NumOfEdges++;
-    }
+  std::vector<StringRef> Paths;
+  for (unsigned ID = 0; ID < MMIOFuncMap.Paths->size(); ID++)
+    Paths.push_back(MMIOFuncMap.Paths->getPath(ID));
+  std::vector<halsnap::MMIOFunc> Records;
+  for (auto &I : MMIOFuncMap) {
+    const MMIOFunc &MF = I.second;
+    const DebugLoc &DL = MF.MMIOIns->getDebugLoc();
+    halsnap::MMIOFunc R;
+    R.Node = Nodes.lookup(I.first);
+    R.FileID = MF.FileID;
+    R.DirID = MF.DirID;
+    R.LocFileID = MF.LocFileID;
+    R.Line = DL ? DL.getLine() : 0;
+    R.Col = DL ? DL.getCol() : 0;
+    R.TransClosureInDeg = MF.TransClosureInDeg;
+    R.NCMA_CG = MF.NCMA_CG;
+    R.NCMA_GroundTruth = MF.NCMA_GroundTruth;
+    R.MacroUsed = MF.MacroUsed;
+    R.Reserved = 0;
+    Records.push_back(R);
   }
-  //dbgs() << "#vertices=" << TotNumOfCGN << " #edges=" << NumOfEdges << "\n";
-  CGNumOfNodes = TotNumOfCGN;
-  CGNumOfEdges = NumOfEdges;
-
-  //std::vector<int> InDegrees = runFloydWarshall(AdjMatrix, TotNumOfCGN);
-  std::vector<int> InDegrees = runTCEst(AdjMatrix, TotNumOfCGN);
 
-  for (auto &I : MMIOFuncMap) {
-    I.second.TransClosureInDeg = InDegrees[CGN2Num.at(CG[I.first])];
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (!EC) {
+    halsnap::write(OS, Graph, NodeNames, Paths, Records);
+    OS.close();
+    EC = OS.error();
   }
+  if (EC)
+    errs() << "Warning: cannot write " << Path << ": " << EC.message()
+           << "\n";
+  Graph = CallGraphCSR();
+  GraphFuncs.clear();
 }
 
-std::vector<int> FindHALBypass::runFloydWarshall(
-    std::vector<int> &AdjMatrix, int TotNumOfCGN) {
-  for (int K = 0; K < TotNumOfCGN; K++) {
-    for (int I = 0; I < TotNumOfCGN; I++) {
-      for (int J = 0; J < TotNumOfCGN; J++) {
-        // reach[i][j] = reach[i][j] || (reach[i][k] && reach[k][j]);
-        AdjMatrix[I * TotNumOfCGN + J] = AdjMatrix[I * TotNumOfCGN + J] ||
-          (AdjMatrix[I * TotNumOfCGN + K] && AdjMatrix[K * TotNumOfCGN + J]);
-      }
-    }
+std::vector<int> FindHALBypass::computeTCInDegrees(const CallGraphCSR &G,
+                                                   ArrayRef<int> Queries) {
+  std::vector<int> InDegrees;
+  switch (TCEngineOpt) {
+  case TCEngine::Estimate: {
+    TCEstOptions Opts;
+    Opts.Backend = TCEstBackendOpt;
+    Opts.NumIter = TCEstIters;
+    Opts.Seed = TCEstSeed;
+    Opts.NumThreads = TCEstThreads;
+    Opts.Adaptive = TCEstAdaptive;
+    Opts.MaxIter = TCEstMaxIters;
+    Opts.Threshold = HalTCThreshold;
+    Opts.Queries = Queries;
+    InDegrees = runTCEst(G, Opts);
+    break;
   }
-
-  std::vector<int> InDegrees(TotNumOfCGN, 0);
-  for (int I = 0; I < TotNumOfCGN; I++) {
-    std::transform(AdjMatrix.begin() + I * TotNumOfCGN,
-                   AdjMatrix.begin() + (I+1) * TotNumOfCGN,
-                   InDegrees.begin(), InDegrees.begin(), std::plus<int>());
+  case TCEngine::Exact:
+    InDegrees = runTCExact(G);
+    break;
+  case TCEngine::Bounded: {
+    // Only up to the threshold used by callGraphBasedHalIdent. The other
+    // nodes are left at 0.
+    std::vector<int> Counts = runTCBounded(G, Queries, HalTCThreshold);
+    InDegrees.assign(G.numNodes(), 0);
+    for (size_t Q = 0; Q < Queries.size(); Q++)
+      InDegrees[Queries[Q]] = Counts[Q];
+    break;
   }
-  return InDegrees;
-}
-
-std::vector<int> FindHALBypass::runTCEst(
-    std::vector<int> &AdjMatrix, int TotNumOfCGN) {
-  // Transpose AdjMatrix
-  //for (int I = 0; I < TotNumOfCGN; I++) {
-  //  for (int J = 0; J < I; J++) {
-  //    // swap AdjMatrix[I][J] and AdjMatrix[J][I]
-  //    std::swap(AdjMatrix[I * TotNumOfCGN + J], AdjMatrix[J * TotNumOfCGN + I]);
-  //  }
-  //}
-
-  std::vector<double> RankLeastSum(TotNumOfCGN, 0.0);
-  std::vector<int> InDegrees(TotNumOfCGN);
-  int NumOfIter = 10;
-  for (int I = 0; I < NumOfIter; I++) {
-    auto RankLeast = runTCEstOneIter(AdjMatrix, TotNumOfCGN);
-    std::transform(RankLeast.begin(), RankLeast.end(), RankLeastSum.begin(),
-                   RankLeastSum.begin(), std::plus<double>());
+  case TCEngine::BFS:
+    InDegrees = runFloydWarshall(G);
+    break;
   }
-  std::transform(RankLeastSum.begin(), RankLeastSum.end(), InDegrees.begin(),
-                 [NumOfIter](double s) {
-                   return std::round(NumOfIter / s) - 1;
-                 });
   return InDegrees;
 }
 
-std::vector<double> FindHALBypass::runTCEstOneIter(
-    std::vector<int> &AdjMatrix, int TotNumOfCGN) {
-  std::random_device RD;
-  std::mt19937 Gen(RD());
-  std::uniform_real_distribution<> UniformDis(0.0, 1.0);
-  std::vector<std::pair<int, double>> Rank;
-  Rank.reserve(TotNumOfCGN);
-  for (int I = 0; I < TotNumOfCGN; I++) {
-    Rank.push_back({I, UniformDis(Gen)});
-  }
-  std::sort(Rank.begin(), Rank.end(), [](auto &LHS, auto &RHS) {
-      return LHS.second < RHS.second;
-  });
-  //for (auto &I : Rank) {
-  //  dbgs() << I.first << " " << I.second << "\n";
-  //}
-
-  std::vector<double> RankLeast(TotNumOfCGN, 0.0);
-  std::vector<int> Visited(TotNumOfCGN, 0);
-  for (auto &Src : Rank) {
-    // BFS on Src.first
-    if (Visited[Src.first])
+int FindHALBypass::getTCThreshold() { return HalTCThreshold; }
+
+void FindHALBypass::applyHalDirRule(DirTree &Tree,
+                                    MutableArrayRef<DirRuleFunc> Funcs) {
+  // Subtree depths count from the common directory of the functions that
+  // have one.
+  int Common = -1;
+  for (const DirRuleFunc &F : Funcs)
+    if (F.Dir != DirTree::getNoDir())
+      Common = Common < 0 ? F.Dir : Tree.getCommonAncestor(Common, F.Dir);
+
+  for (const DirRuleFunc &F : Funcs) {
+    DirTree::Stats &S = Tree.getStats(F.Dir);
+    S.NumFuncs++;
+    S.MaxTC = std::max(S.MaxTC, F.TransClosureInDeg);
+    //if (F.TransClosureInDeg >= CallGraphTCInDegPctl(75.0)) {
+    if (F.TransClosureInDeg < HalTCThreshold)
       continue;
-    std::queue<int> BFSQueue;
-
-    BFSQueue.push(Src.first);
-    Visited[Src.first] = 1;
-    RankLeast[Src.first] = Src.second;
-
-    while (!BFSQueue.empty()) {
-      int U = BFSQueue.front();
-      BFSQueue.pop();
-      for (int V = 0; V < TotNumOfCGN; V++) {
-        if (AdjMatrix[U * TotNumOfCGN + V] == 0 || Visited[V])
-          continue;
-        BFSQueue.push(V);
-        Visited[V] = 1;
-        RankLeast[V] = Src.second;
-      }
-    }
+    S.NumOverThreshold++;
+    if (HalSubtreeDepth && F.Dir != DirTree::getNoDir())
+      Tree.markHal(Tree.getAncestor(F.Dir, Tree.getDepth(Common) +
+                                               HalSubtreeDepth),
+                   /*Subtree=*/true);
+    else
+      Tree.markHal(F.Dir, /*Subtree=*/false);
   }
-  return RankLeast;
-}
-
-void FindHALBypass::computeCallGraphInDeg(llvm::CallGraph &CG) {
-  for (auto &I : MMIOFuncMap) {
-    I.second.InDegree = 0;
+  for (DirRuleFunc &F : Funcs) {
+    F.NCMA_CG = !F.MacroUsed && !Tree.isHal(F.Dir);
+    if (F.NCMA_CG)
+      Tree.getStats(F.Dir).NumNCMA_CG++;
   }
 
-  for (auto &I : CG) {
-    //const Function *Caller = I.first;
-    for (auto &J : *I.second) {
-      const Function *Callee = J.second->getFunction();
-      //auto *CI = cast<CallInst>(static_cast<Value *>(J.first.getValue()));
-      //MMIOFuncMap[Callee].InDegree++;
-      auto Iter = MMIOFuncMap.find(Callee);
-      if (Iter != MMIOFuncMap.end()) {
-        Iter->second.InDegree++;
-      }
-    }
+  if (HalDirRollupFile.empty())
+    return;
+  Tree.rollUp();
+  std::error_code EC;
+  raw_fd_ostream OS(HalDirRollupFile, EC, sys::fs::OF_Text);
+  if (!EC) {
+    Tree.writeRollup(OS);
+    OS.close();
+    EC = OS.error();
   }
+  if (EC)
+    errs() << "Warning: cannot write " << HalDirRollupFile << ": "
+           << EC.message() << "\n";
+}
+
+void FindHALBypass::computeCallGraphInDeg(const FlatCallGraph &CG) {
+  std::vector<int> InDegrees(CG.numNodes(), 0);
+  for (const FlatCallGraph::Edge &E : CG.edges())
+    InDegrees[E.second]++;
+  for (auto &I : MMIOFuncMap)
+    I.second.InDegree = InDegrees[CG.getNode(I.first)];
 }
 
 int FindHALBypass::CallGraphTCInDegPctl(double percent) {
@@ -341,19 +657,61 @@ PreservedAnalyses FindHALBypassPrinter::run(Module &M,
 
   auto &Res = MAM.getResult<FindHALBypass>(M);
 
-  printHALBypassResult(OS, Res);
+  print(Res);
   return PreservedAnalyses::all();
 }
 
+void FindHALBypassPrinter::print(const FindHALBypass::Result &Res) {
+  if (Fmt == Format::JSONL)
+    printHALBypassJSONL(OS, Res);
+  else
+    printHALBypassResult(OS, Res);
+}
+
+void FindHALBypassPrinter::print(ArrayRef<HALBypassReportEntry> Entries) {
+  if (Fmt == Format::JSONL)
+    printHALBypassJSONL(OS, Entries);
+  else
+    printHALBypassResult(OS, Entries);
+}
+
+Expected<FindHALBypassPrinter>
+FindHALBypassPrinter::create(StringRef Params) {
+  Format Fmt = Format::Text;
+  StringRef Out;
+  while (!Params.empty()) {
+    StringRef Param;
+    std::tie(Param, Params) = Params.split(';');
+    if (Param.empty())
+      continue;
+    StringRef Key, Value;
+    std::tie(Key, Value) = Param.split('=');
+    if (Key == "format" && Value == "text")
+      Fmt = Format::Text;
+    else if (Key == "format" && Value == "jsonl")
+      Fmt = Format::JSONL;
+    else if (Key == "out" && !Value.empty())
+      Out = Value;
+    else
+      return createStringError(inconvertibleErrorCode(),
+                               "print<hal-bypass>: invalid parameter '" +
+                                   Param + "'");
+  }
+  if (Out.empty())
+    return FindHALBypassPrinter(llvm::errs(), Fmt);
+  std::error_code EC;
+  auto File = std::make_unique<raw_fd_ostream>(Out, EC, sys::fs::OF_Text);
+  if (EC)
+    return createStringError(EC, "print<hal-bypass>: cannot open " + Out +
+                                     ": " + EC.message());
+  return FindHALBypassPrinter(std::move(File), Fmt);
+}
+
 FindHALBypass::Result FindHALBypass::run(llvm::Module &M,
                                          llvm::ModuleAnalysisManager &MAM) {
   auto start_time = std::chrono::high_resolution_clock::now();
-  //auto &Funcs = MAM.getResult<FindMMIOFunc>(M);
-  auto Res = runOnModule(M, MAM.getResult<FindMMIOFunc>(M));
-  auto end_time = std::chrono::high_resolution_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-      end_time - start_time);
-  dbgs() << "# of Node vs. Analysis time: " << CGNumOfNodes << " " << duration.count() << "\n";
+  auto Res = runOnModule(M);
+  printAnalysisTime(CGNumOfNodes, start_time);
   return Res;
 }
 
@@ -376,15 +734,23 @@ AnalysisKey FindHALBypass::Key;
 llvm::PassPluginLibraryInfo getFindHALBypassPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "hal-bypass", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
-            // #1 REGISTRATION FOR "opt -passes=print<hal-bypass>"
+            // #1 REGISTRATION FOR "opt -passes=print<hal-bypass>" and
+            // "print<hal-bypass;format=jsonl;out=path>"
             PB.registerPipelineParsingCallback(
                 [&](StringRef Name, ModulePassManager &MPM,
                     ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == "print<hal-bypass>") {
-                    MPM.addPass(FindHALBypassPrinter(llvm::errs()));
-                    return true;
+                  if (!Name.consume_front("print<hal-bypass") ||
+                      !Name.consume_back(">") ||
+                      !(Name.empty() || Name.startswith(";")))
+                    return false;
+                  Expected<FindHALBypassPrinter> Printer =
+                      FindHALBypassPrinter::create(Name);
+                  if (!Printer) {
+                    errs() << toString(Printer.takeError()) << "\n";
+                    return false;
                   }
-                  return false;
+                  MPM.addPass(std::move(*Printer));
+                  return true;
                 });
             // #2 REGISTRATION FOR "MAM.getResult<FindHALBypass>(Module)"
             PB.registerAnalysisRegistrationCallback(
@@ -416,90 +782,13 @@ llvmGetPassPluginInfo() {
 //------------------------------------------------------------------------------
 // Helper functions
 //------------------------------------------------------------------------------
-// Copied from https://stackoverflow.com/questions/4774116/realpath-without-resolving-symlinks
-static char * normalize_path(const char * src, size_t src_len) {
-  char * res;
-  size_t res_len;
-
-  const char * ptr = src;
-  const char * end = &src[src_len];
-  const char * next;
-
-  if (src_len == 0 || src[0] != '/') {
-
-	// relative path
-
-	char pwd[PATH_MAX];
-	size_t pwd_len;
-
-	if (getcwd(pwd, sizeof(pwd)) == NULL) {
-	  return NULL;
-	}
-
-	pwd_len = strlen(pwd);
-	res = (char *)malloc(pwd_len + 1 + src_len + 1);
-    if (!res) return NULL;
-	memcpy(res, pwd, pwd_len);
-	res_len = pwd_len;
-  } else {
-	res = (char *)malloc((src_len > 0 ? src_len : 1) + 1);
-    if (!res) return NULL;
-	res_len = 0;
-  }
-
-  for (ptr = src; ptr < end; ptr=next+1) {
-	size_t len;
-	next = (const char *)memchr(ptr, '/', end-ptr);
-	if (next == NULL) {
-	  next = end;
-	}
-	len = next-ptr;
-	switch(len) {
-	  case 2:
-		if (ptr[0] == '.' && ptr[1] == '.') {
-		  const char * slash = (const char *)memrchr(res, '/', res_len);
-		  if (slash != NULL) {
-			res_len = slash - res;
-		  }
-		  continue;
-		}
-		break;
-	  case 1:
-		if (ptr[0] == '.') {
-		  continue;
-
-		}
-		break;
-	  case 0:
-		continue;
-	}
-	res[res_len++] = '/';
-	memcpy(&res[res_len], ptr, len);
-	res_len += len;
-  }
-
-  if (res_len == 0) {
-	res[res_len++] = '/';
-  }
-  res[res_len] = '\0';
-  return res;
-}
-
-static std::string resolvePath(StringRef Dir, StringRef Filename) {
-  std::string FullPath = std::string(Dir) + "/" + std::string(Filename);
-  char *ResolvedPath = normalize_path(FullPath.c_str(), FullPath.size());
-  std::string Ret = ResolvedPath ? std::string(ResolvedPath) : FullPath;
-  free(ResolvedPath);
-  return Ret;
-}
-
-static void printDebugLoc(raw_ostream &OS, const DebugLoc &DL) {
+static void printDebugLoc(raw_ostream &OS, const DebugLoc &DL,
+                          StringRef Path) {
   if (!DL)
     return;
 
    // Print source line info.
-   auto *Scope = cast<DIScope>(DL.getScope());
-   OS << resolvePath(Scope->getDirectory(), Scope->getFilename());
+   OS << Path;
    OS << ':' << DL.getLine();
    if (DL.getCol() != 0)
      OS << ':' << DL.getCol();
@@ -511,57 +800,153 @@ static void printDebugLoc(raw_ostream &OS, const DebugLoc &DL) {
    }
 }
 
-static void printFuncs(raw_ostream &OutS,
-                       const FindHALBypass::Result &MMIOFuncs,
-                       const char *Str, const char *Head) {
+// Calls Fn on the entry of each MMIO function, or of those whose
+// NCMA_GroundTruth is Truth if given. The entries of a Result are built one
+// at a time, so that the result is not copied.
+static void forEachEntry(const FindHALBypass::Result &MMIOFuncs,
+                         Optional<bool> Truth,
+                         function_ref<void(const HALBypassReportEntry &)> Fn) {
+  for (auto &Node : MMIOFuncs)
+    if (!Truth || Node.second.NCMA_GroundTruth == *Truth)
+      Fn(Node.second.getReportEntry(*MMIOFuncs.Paths, *MMIOFuncs.Sites));
+}
+
+static void forEachEntry(ArrayRef<HALBypassReportEntry> MMIOFuncs,
+                         Optional<bool> Truth,
+                         function_ref<void(const HALBypassReportEntry &)> Fn) {
+  for (auto &Node : MMIOFuncs)
+    if (!Truth || Node.NCMA_GroundTruth == *Truth)
+      Fn(Node);
+}
+
+static bool isNonConv(const FindHALBypass::Result::value_type &Node) {
+  return Node.second.NCMA_GroundTruth;
+}
+
+static bool isNonConv(const HALBypassReportEntry &Node) {
+  return Node.NCMA_GroundTruth;
+}
+
+template <typename ResultT>
+static void printFuncs(raw_ostream &OutS, const ResultT &MMIOFuncs,
+                       bool NonConv, const char *Str, const char *Head) {
+  size_t Num = std::count_if(
+      MMIOFuncs.begin(), MMIOFuncs.end(),
+      [NonConv](const auto &Node) { return isNonConv(Node) == NonConv; });
   OutS << "================================================="
        << "\n";
-  OutS << "LLVM-TUTOR: " << Str << " (# = " << MMIOFuncs.size() << ")\n";
+  OutS << "LLVM-TUTOR: " << Str << " (# = " << Num << ")\n";
   OutS << "Function, Location of MMIO inst, TC In-degree, NCMA(CG), NCMA(truth), Macro\n";
   OutS << "-------------------------------------------------"
        << "\n";
 
-  for (auto &Node : MMIOFuncs) {
+  forEachEntry(MMIOFuncs, NonConv, [&](const HALBypassReportEntry &Node) {
     OutS << Head << ": ";
-    OutS << Node.first->getName() << " ";
-    printDebugLoc(OutS, Node.second.MMIOIns->getDebugLoc());
-    //OutS << " " << Node.second.InDegree;
-    OutS << " " << Node.second.TransClosureInDeg;
-    //OutS << " " << Node.second.IsHalPattern;
-    OutS << " " << Node.second.NCMA_CG;
-    OutS << " " << Node.second.NCMA_GroundTruth;
-    OutS << " " << Node.second.MacroUsed;
+    OutS << Node.Name << " ";
+    OutS << Node.Loc;
+    //OutS << " " << Node.InDegree;
+    OutS << " " << Node.TransClosureInDeg;
+    //OutS << " " << Node.IsHalPattern;
+    OutS << " " << Node.NCMA_CG;
+    OutS << " " << Node.NCMA_GroundTruth;
+    OutS << " " << Node.MacroUsed;
     OutS << "\n";
-  }
+  });
 
   OutS << "-------------------------------------------------"
        << "\n\n";
 }
 
+// An address as printed in the reports.
+static std::string formatAddr(uint64_t Addr) {
+  std::string Str;
+  raw_string_ostream(Str) << format_hex(Addr, 10);
+  return Str;
+}
+
+// The number of MMIO instructions of each MMIO function and the range of
+// addresses they access.
+template <typename ResultT>
+static void printSites(raw_ostream &OutS, const ResultT &MMIOFuncs) {
+  OutS << "================================================="
+       << "\n";
+  OutS << "LLVM-TUTOR: MMIO instructions per function\n";
+  OutS << "Function, MMIO instructions, Lowest address, Highest address\n";
+  OutS << "-------------------------------------------------"
+       << "\n";
+  forEachEntry(MMIOFuncs, None, [&](const HALBypassReportEntry &Node) {
+    OutS << "Sites: " << Node.Name << " " << Node.NumSites << " "
+         << formatAddr(Node.MinAddr) << " " << formatAddr(Node.MaxAddr)
+         << "\n";
+  });
+  OutS << "-------------------------------------------------"
+       << "\n\n";
+}
+
+// With -hal-svd, the MMIO functions and MMIO instructions per peripheral,
+// and the MMIO instructions per register of the peripheral. A function
+// counts for every peripheral one of its MMIO instructions accesses.
+template <typename ResultT>
+static void printPeripherals(raw_ostream &OutS, const ResultT &MMIOFuncs) {
+  struct Counts {
+    unsigned NumFuncs = 0;
+    unsigned NumNCMA_CG = 0;
+    unsigned NumNCMA_GroundTruth = 0;
+    unsigned NumSites = 0;
+    std::map<std::string, unsigned> Registers;
+  };
+  std::map<std::string, Counts> Peripherals;
+  forEachEntry(MMIOFuncs, None, [&](const HALBypassReportEntry &Node) {
+    // The accesses are sorted, so those of a peripheral are adjacent.
+    const std::string *Last = nullptr;
+    for (const HALBypassReportEntry::Access &A : Node.Accesses) {
+      Counts &C = Peripherals[A.Peripheral.empty() ? "-" : A.Peripheral];
+      if (!Last || *Last != A.Peripheral) {
+        C.NumFuncs++;
+        C.NumNCMA_CG += Node.NCMA_CG;
+        C.NumNCMA_GroundTruth += Node.NCMA_GroundTruth;
+      }
+      Last = &A.Peripheral;
+      C.NumSites += A.Count;
+      if (!A.Register.empty())
+        C.Registers[A.Register] += A.Count;
+    }
+  });
+
+  OutS << "================================================="
+       << "\n";
+  OutS << "LLVM-TUTOR: MMIO functions per peripheral (# = "
+       << Peripherals.size() << ")\n";
+  OutS << "Peripheral, MMIO functions, NCMA(CG), NCMA(truth), "
+          "MMIO instructions, Register:MMIO instructions...\n";
+  OutS << "-------------------------------------------------"
+       << "\n";
+  for (auto &P : Peripherals) {
+    OutS << "Peripheral: " << P.first << " " << P.second.NumFuncs << " "
+         << P.second.NumNCMA_CG << " " << P.second.NumNCMA_GroundTruth << " "
+         << P.second.NumSites;
+    for (auto &R : P.second.Registers)
+      OutS << " " << R.first << ":" << R.second;
+    OutS << "\n";
+  }
+  OutS << "-------------------------------------------------"
+       << "\n\n";
+}
+
 static inline void printStatistics(raw_ostream &OutS, const char *Caption,
                                    size_t S1, size_t S2) {
   OutS << Caption<< S1 << "/" << S2 << "=" << static_cast<float>(S1) / S2 << " ";
 }
 
-static void printHALBypassResult(raw_ostream &OutS,
-                                 const FindHALBypass::Result &MMIOFuncs) {
-  //FindHALBypass::Result AppFuncs;
-  //FindHALBypass::Result LibHalFuncs;
-  //FindHALBypass::Result TPFuncs, FPFuncs, FNFuncs, TNFuncs;
-  FindHALBypass::Result NonConv, Conv;
-  for (auto &Node : MMIOFuncs) {
-    //if (!Node.second.IsHalPattern && !Node.second.IsHalCG)
-    if (Node.second.NCMA_GroundTruth)
-      NonConv.insert(Node);
-    //else if (Node.second.IsHal && !Node.second.IsHal2)
-    //  FPFuncs.insert(Node);
-    //else if (!Node.second.IsHal && Node.second.IsHal2)
-    //  FNFuncs.insert(Node);
-    else
-      Conv.insert(Node);
-  }
-  printFuncs(OutS, NonConv, "Non-conventional MMIO functions", "Non-HAL");
-  printFuncs(OutS, Conv, "Conventional (HAL) MMIO functions", "HAL");
+template <typename ResultT>
+static void printHALBypassResult(raw_ostream &OutS, const ResultT &MMIOFuncs) {
+  printFuncs(OutS, MMIOFuncs, true, "Non-conventional MMIO functions",
+             "Non-HAL");
+  printFuncs(OutS, MMIOFuncs, false, "Conventional (HAL) MMIO functions",
+             "HAL");
+  printSites(OutS, MMIOFuncs);
+  if (PeripheralIndex::get())
+    printPeripherals(OutS, MMIOFuncs);
   //printFuncs(OutS, TPFuncs, "True Positive: Non-conventional MMIO functions");
   //printFuncs(OutS, FPFuncs, "False Positive: Incorrectly identified as Non-conventional MMIO functions");
   //printFuncs(OutS, FNFuncs, "False Negative: Missed Non-conventional MMIO functions");
@@ -571,3 +956,39 @@ static void printHALBypassResult(raw_ostream &OutS,
   //printStatistics(OutS, "NPV="           , TNFuncs.size(), TNFuncs.size() + FNFuncs.size());
   //printStatistics(OutS, "TNR="           , TNFuncs.size(), TNFuncs.size() + FPFuncs.size());
 }
+
+template <typename ResultT>
+static void printHALBypassJSONL(raw_ostream &OutS, const ResultT &MMIOFuncs) {
+  forEachEntry(MMIOFuncs, None, [&](const HALBypassReportEntry &Node) {
+    json::OStream J(OutS);
+    J.object([&] {
+      J.attribute("function", Node.Name);
+      J.attribute("file", Node.File);
+      J.attribute("line", Node.Line);
+      J.attribute("col", Node.Col);
+      J.attribute("loc", Node.Loc);
+      J.attribute("tc_in_degree", Node.TransClosureInDeg);
+      J.attribute("ncma_cg", Node.NCMA_CG);
+      J.attribute("ncma_truth", Node.NCMA_GroundTruth);
+      J.attribute("macro", Node.MacroUsed);
+      J.attribute("sites", Node.NumSites);
+      // As in the text report: JSON numbers cannot hold every 64-bit
+      // address exactly.
+      J.attribute("addr_min", formatAddr(Node.MinAddr));
+      J.attribute("addr_max", formatAddr(Node.MaxAddr));
+      if (PeripheralIndex::get()) {
+        J.attribute("peripheral", Node.Peripheral);
+        J.attribute("register", Node.Register);
+        J.attributeArray("accesses", [&] {
+          for (const HALBypassReportEntry::Access &A : Node.Accesses)
+            J.object([&] {
+              J.attribute("peripheral", A.Peripheral);
+              J.attribute("register", A.Register);
+              J.attribute("count", A.Count);
+            });
+        });
+      }
+    });
+    OutS << "\n";
+  });
+}
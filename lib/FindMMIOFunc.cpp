@@ -25,14 +25,27 @@
 // License: MIT
 //==============================================================================
 #include "FindMMIOFunc.h"
+#include "FunctionSummary.h"
+#include "HalRules.h"
 
-#include "llvm/Analysis/CallGraph.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-#include <regex>
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
 
 using namespace llvm;
 
+cl::opt<unsigned> MMIOScanThreads(
+    "mmio-scan-threads",
+    cl::desc("Threads scanning functions for MMIO instructions (0 = all "
+             "hardware threads, 1 = serial)"),
+    cl::init(0));
+
+// Functions handed to a scanning thread at a time.
+static const size_t ScanChunkSize = 64;
+
 // Pretty-prints the result of this analysis
 static void printMMIOFuncResult(llvm::raw_ostream &OutS,
                                 const FindMMIOFunc::Result &);
@@ -51,10 +64,7 @@ bool FindMMIOFunc::isMMIOInst_(llvm::Instruction *Ins) {
     return false;
 
   MY_DEBUG(dbgs() << *Ins << "\n");
-  const APInt &Addr = cast<ConstantInt>(CE->getOperand(0))->getValue();
-  SmallVector<char> Str;
-  Addr.toStringUnsigned(Str, 16);
-  MY_DEBUG(dbgs() << "Addr: 0x" << Str << "\n");
+  MY_DEBUG(dbgs() << "Addr: " << *CE->getOperand(0) << "\n");
 
   const DebugLoc &Debug = Ins->getDebugLoc();
   if (Debug) {
@@ -64,26 +74,203 @@ bool FindMMIOFunc::isMMIOInst_(llvm::Instruction *Ins) {
   return true;
 }
 
+// Every instruction is checked: walking the use lists of the inttoptr
+// constant expressions instead would first need them enumerated, and LLVM
+// keeps the uniqued constants of a context in the private LLVMContextImpl.
 bool FindMMIOFunc::isMMIOInst(llvm::Instruction *Ins) {
   return (isMMIOInst_<LoadInst>(Ins) || isMMIOInst_<StoreInst>(Ins) ||
           isMMIOInst_<GetElementPtrInst>(Ins));
 }
 
-void FindMMIOFunc::findMMIOFunc(Module &M, Result &MMIOFuncs) {
-  for (auto &Func : M) {
-    //if (ignoreFunc(Func))
-    //  continue;
-    for (auto &Ins : instructions(Func)) {
-      if (!isMMIOInst(&Ins))
-        continue;
-      if (Ins.getDebugLoc() && Ins.getDebugLoc().getInlinedAt())
+// Calls are never MMIO instructions, so each instruction is looked at
+// either as a call or as a candidate MMIO instruction.
+const Instruction *
+FindMMIOFunc::findMMIOInst(Function &Func,
+                           std::vector<const Instruction *> &Sites,
+                           const FlatCallGraph *CG,
+                           FlatCallGraph::BodyEdges *Body) {
+  int Caller = CG ? CG->getNode(&Func) : -1;
+  size_t First = Sites.size();
+  for (auto &Ins : instructions(Func)) {
+    if (CG)
+      CG->addInstruction(Caller, Ins, *Body);
+    if (isa<CallBase>(Ins) || !isMMIOInst(&Ins))
+      continue;
+    if (Ins.getDebugLoc() && Ins.getDebugLoc().getInlinedAt())
+      continue;
+    Sites.push_back(&Ins);
+  }
+  return Sites.size() > First ? Sites[First] : nullptr;
+}
+
+FunctionSummary *FindMMIOFunc::scanFunc(
+    Function &Func, std::vector<const Instruction *> &Sites,
+    const Instruction *&Site, bool &MacroUsed, const FlatCallGraph *CG,
+    FlatCallGraph::BodyEdges *Body) {
+  Site = findMMIOInst(Func, Sites, CG, Body);
+  MacroUsed = false;
+  if (!Site)
+    return nullptr;
+  FunctionSummaryStore *Store = FunctionSummaryStore::get();
+  if (!Store) {
+    MacroUsed = ignoreFunc(Func);
+    return nullptr;
+  }
+
+  FunctionSummaryStore::Key K = FunctionSummaryStore::getKey(Func);
+  if (FunctionSummary *S = Store->lookup(K)) {
+    MacroUsed = S->MacroUsed;
+    return S;
+  }
+  MacroUsed = ignoreFunc(Func);
+  return Store->insert(K, MacroUsed);
+}
+
+bool FindMMIOFunc::addFunction(Function &Func, Result &MMIOFuncs,
+                               std::vector<const Instruction *> &Sites,
+                               FlatCallGraph *CG) {
+  const Instruction *Site;
+  bool MacroUsed;
+  FlatCallGraph::BodyEdges Body;
+  size_t FirstSite = Sites.size();
+  FunctionSummary *Summary =
+      scanFunc(Func, Sites, Site, MacroUsed, CG, &Body);
+  if (CG)
+    CG->addBodyEdges(Body);
+  if (!Site)
+    return false;
+  MMIOFunc MF(Site, MacroUsed);
+  MF.Summary = Summary;
+  MF.FirstSite = FirstSite;
+  MF.NumSites = Sites.size() - FirstSite;
+  MMIOFuncs.insert({&Func, MF});
+  return true;
+}
+
+// The scan only reads the IR, so functions are scanned in parallel: threads
+// take chunks of functions from a shared counter until none is left and
+// record their findings in per-function slots, and their MMIO instructions
+// and call edges in per-chunk lists, which are merged in module order
+// afterwards.
+void FindMMIOFunc::findMMIOFunc(Module &M, Result &MMIOFuncs,
+                                FlatCallGraph *CG) {
+  std::vector<Function *> Funcs;
+  for (auto &Func : M)
+    if (!Func.isDeclaration())
+      Funcs.push_back(&Func);
+  std::vector<const Instruction *> Found(Funcs.size(), nullptr);
+  std::vector<char> Ignored(Funcs.size(), false);
+  std::vector<FunctionSummary *> Summaries(Funcs.size(), nullptr);
+  std::vector<unsigned> NumSites(Funcs.size(), 0);
+  size_t NumChunks = (Funcs.size() + ScanChunkSize - 1) / ScanChunkSize;
+  std::vector<FlatCallGraph::BodyEdges> Bodies(NumChunks);
+  std::vector<std::vector<const Instruction *>> ChunkSites(NumChunks);
+  auto ScanRange = [&](size_t Begin, size_t End) {
+    for (size_t I = Begin; I < End; I++) {
+      //if (ignoreFunc(*Funcs[I]))
+      //  continue;
+      bool MacroUsed;
+      std::vector<const Instruction *> &Sites = ChunkSites[I / ScanChunkSize];
+      size_t Before = Sites.size();
+      Summaries[I] = scanFunc(*Funcs[I], Sites, Found[I], MacroUsed, CG,
+                              &Bodies[I / ScanChunkSize]);
+      Ignored[I] = MacroUsed;
+      NumSites[I] = Sites.size() - Before;
+    }
+  };
+
+  // Load the rules before starting the threads, so that rule errors are
+  // reported from this one.
+  HalRules::get();
+  ThreadPoolStrategy Strategy = hardware_concurrency(MMIOScanThreads);
+  unsigned NumThreads = std::min<size_t>(
+      Strategy.compute_thread_count(),
+      (Funcs.size() + ScanChunkSize - 1) / ScanChunkSize);
+  if (NumThreads <= 1) {
+    ScanRange(0, Funcs.size());
+  } else {
+    ThreadPool Pool(Strategy);
+    std::atomic<size_t> NextChunk(0);
+    for (unsigned T = 0; T < NumThreads; T++)
+      Pool.async([&] {
+        size_t Begin;
+        while ((Begin = NextChunk.fetch_add(ScanChunkSize)) < Funcs.size())
+          ScanRange(Begin, std::min(Begin + ScanChunkSize, Funcs.size()));
+      });
+    Pool.wait();
+  }
+
+  if (CG)
+    for (auto &Body : Bodies)
+      CG->addBodyEdges(Body);
+  std::vector<const Instruction *> Sites;
+  const Instruction *const *Next = nullptr;
+  for (size_t I = 0; I < Funcs.size(); I++) {
+    if (I % ScanChunkSize == 0)
+      Next = ChunkSites[I / ScanChunkSize].data();
+    if (!Found[I])
+      continue;
+    MY_DEBUG(dbgs() << "MMIO func: " << Funcs[I]->getName() << "\n");
+    // MMIOFuncs[&Func] = MMIOFunc(&Ins);
+    MMIOFunc MF(Found[I], Ignored[I]);
+    MF.Summary = Summaries[I];
+    MF.FirstSite = Sites.size();
+    MF.NumSites = NumSites[I];
+    Sites.insert(Sites.end(), Next, Next + NumSites[I]);
+    Next += NumSites[I];
+    MMIOFuncs.insert({Funcs[I], MF});
+  }
+  buildSiteTable(MMIOFuncs, Sites);
+}
+
+// Index of the pointer operand of an instruction isMMIOInst accepts, or -1.
+static int pointerOperandIndex(const Instruction &Ins) {
+  switch (Ins.getOpcode()) {
+  case Instruction::Load:
+    return LoadInst::getPointerOperandIndex();
+  case Instruction::Store:
+    return StoreInst::getPointerOperandIndex();
+  case Instruction::GetElementPtr:
+    return GetElementPtrInst::getPointerOperandIndex();
+  default:
+    return -1;
+  }
+}
+
+Optional<uint64_t> FindMMIOFunc::getMMIOAddress(const Instruction &Ins) {
+  int Idx = pointerOperandIndex(Ins);
+  auto *CE = Idx < 0 ? nullptr : dyn_cast<ConstantExpr>(Ins.getOperand(Idx));
+  if (!CE || CE->getOpcode() != Instruction::IntToPtr)
+    return None;
+  auto *Addr = dyn_cast<ConstantInt>(CE->getOperand(0));
+  if (!Addr || Addr->getValue().getActiveBits() > 64)
+    return None;
+  return Addr->getZExtValue();
+}
+
+void FindMMIOFunc::buildSiteTable(Result &MMIOFuncs,
+                                  ArrayRef<const Instruction *> Sites) {
+  std::vector<uint32_t> Funcs(Sites.size());
+  uint32_t FuncIdx = 0;
+  for (auto &Node : MMIOFuncs) {
+    const MMIOFunc &MF = Node.second;
+    std::fill_n(Funcs.begin() + MF.FirstSite, MF.NumSites, FuncIdx++);
+  }
+
+  auto Table = std::make_shared<MMIOSiteTable>(Sites, Funcs);
+  for (auto &Node : MMIOFuncs) {
+    MMIOFunc &MF = Node.second;
+    bool Found = false;
+    for (size_t I = MF.FirstSite; I < MF.FirstSite + MF.NumSites; I++) {
+      if (!Table->hasAddress(I))
         continue;
-      MY_DEBUG(dbgs() << "MMIO func: " << Func.getName() << "\n");
-      // MMIOFuncs[&Func] = MMIOFunc(&Ins);
-      MMIOFuncs.insert({&Func, MMIOFunc(&Ins, ignoreFunc(Func))});
-      break;
+      uint64_t Addr = Table->getAddress(I);
+      MF.MinAddr = Found ? std::min(MF.MinAddr, Addr) : Addr;
+      MF.MaxAddr = Found ? std::max(MF.MaxAddr, Addr) : Addr;
+      Found = true;
     }
   }
+  MMIOFuncs.Sites = std::move(Table);
 }
 
 // Ugly workaround to filter out functions that call macro HAL functions
@@ -93,27 +280,33 @@ bool FindMMIOFunc::ignoreFunc(llvm::Function &F) {
   DIFile *File = DISub->getFile();
   std::string FullPath = std::string(File->getDirectory()) + "/"
                          + std::string(File->getFilename());
-  std::regex PathRe("(freertos.*(queue|tasks|timers|event_groups)\\.c"
-                    "|freertos-plus-tcp/tools/tcp_utilities/tcp_netstat\\.c"
-                    "|Cicada-FW"
-                    "|RP2040-FreeRTOS/App-IRQs/main\\.cpp"
-                    ")",
-                    std::regex::icase);
-  if (std::regex_search(FullPath, PathRe))
+  // See the ignore-path and ignore-func rules
+  const HalRules &Rules = HalRules::get();
+  if (Rules.isIgnoredPath(FullPath))
     return true;
-  // USB_Send_Message is in Embedded-GUI-for-MT2523/middleware/MTK/usb/src/_common/usb_main.c:135:9
-  std::regex FuncRe("Pinetime.*PushMessage|nrfx_gpiote_evt_handler|USB_Send_Message");
-  if (F.hasName() && std::regex_search(std::string(F.getName()), FuncRe))
+  if (F.hasName() && Rules.isIgnoredFunc(F.getName()))
     return true;
   return false;
 }
 
-FindMMIOFunc::Result FindMMIOFunc::runOnModule(Module &M) {
+FindMMIOFunc::Result FindMMIOFunc::runOnModule(Module &M, FlatCallGraph *CG) {
   Result Res;
-  findMMIOFunc(M, Res);
+  findMMIOFunc(M, Res, CG);
   return Res;
 }
 
+bool FindMMIOFunc::isInvalidated(AnalysisKey *ID,
+                                 const PreservedAnalyses &PA) {
+  auto PAC = PA.getChecker(ID);
+  return !PAC.preserved() && !PAC.preservedSet<AllAnalysesOn<Module>>() &&
+         !PAC.preservedSet<HALBypassAnalyses>();
+}
+
+bool FindMMIOFunc::Result::invalidate(Module &, const PreservedAnalyses &PA,
+                                      ModuleAnalysisManager::Invalidator &) {
+  return isInvalidated(FindMMIOFunc::ID(), PA);
+}
+
 PreservedAnalyses FindMMIOFuncPrinter::run(Module &M,
                                            ModuleAnalysisManager &MAM) {
 
@@ -141,6 +334,7 @@ FindMMIOFunc::Result FindMMIOFunc::run(llvm::Module &M,
 // New PM Registration
 //------------------------------------------------------------------------------
 AnalysisKey FindMMIOFunc::Key;
+AnalysisSetKey HALBypassAnalyses::SetKey;
 
 llvm::PassPluginLibraryInfo getFindMMIOFuncPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "mmio-func", LLVM_VERSION_STRING,
@@ -0,0 +1,267 @@
+//==============================================================================
+// FILE:
+//    FlatCallGraph.cpp
+//
+// DESCRIPTION:
+//    Nodes and edges of llvm::CallGraph (see CallGraph::addToCallGraph and
+//    CallGraph::populateCallGraphNode), without the CallGraphNode objects,
+//    and the optional resolution of indirect calls.
+//
+// License: MIT
+//==============================================================================
+#include "FlatCallGraph.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/AbstractCallSite.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <tuple>
+
+using namespace llvm;
+
+enum class IndirectCallMode { None, Type, Field };
+
+static cl::opt<IndirectCallMode> IndirectCallsOpt(
+    "hal-indirect-calls", cl::desc("How indirect calls are resolved"),
+    cl::values(clEnumValN(IndirectCallMode::None, "none",
+                          "Only to the calls-external node (default)"),
+               clEnumValN(IndirectCallMode::Type, "type",
+                          "Also to the address-taken functions of the same "
+                          "signature"),
+               clEnumValN(IndirectCallMode::Field, "field",
+                          "As type, but only to the functions stored into "
+                          "the struct field the callee is loaded from, "
+                          "when there are any")),
+    cl::init(IndirectCallMode::None));
+
+static cl::opt<unsigned> IndirectMaxTargets(
+    "hal-indirect-max-targets",
+    cl::desc("Leave indirect calls with more candidate callees than this "
+             "unresolved"),
+    cl::init(64));
+
+// F if V is F or a pointer cast of it.
+static const Function *getFunctionRef(const Value *V) {
+  return dyn_cast<Function>(V->stripPointerCasts());
+}
+
+// The struct field P points to, if P is a GEP to one.
+static FlatCallGraph::Field getField(const Value *P) {
+  auto *GEP = dyn_cast<GEPOperator>(P);
+  if (!GEP || GEP->getNumIndices() < 2)
+    return {};
+  SmallVector<Value *, 4> Indices(GEP->idx_begin(), std::prev(GEP->idx_end()));
+  auto *STy = dyn_cast_or_null<StructType>(
+      GetElementPtrInst::getIndexedType(GEP->getSourceElementType(), Indices));
+  auto *Index = dyn_cast<ConstantInt>(*std::prev(GEP->idx_end()));
+  if (!STy || !Index)
+    return {};
+  return {STy, static_cast<unsigned>(Index->getZExtValue())};
+}
+
+// The struct field the callee of an indirect call is loaded from, if any.
+static FlatCallGraph::Field getLoadedField(const Value *Callee) {
+  auto *LI = dyn_cast<LoadInst>(Callee);
+  return LI ? getField(LI->getPointerOperand()) : FlatCallGraph::Field();
+}
+
+FlatCallGraph::FlatCallGraph(Module &M) {
+  Funcs.reserve(M.size());
+  Nodes.reserve(M.size());
+  for (const Function &F : M) {
+    if (isDbgInfoIntrinsic(F.getIntrinsicID()))
+      continue;
+    Nodes[&F] = numFuncs();
+    Funcs.push_back(&F);
+  }
+  for (int N = 0; N < numFuncs(); N++) {
+    const Function &F = *Funcs[N];
+    // If F has external linkage or has its address taken, anything could
+    // call it.
+    if (!F.hasLocalLinkage() ||
+        F.hasAddressTaken(nullptr, /*IgnoreCallbackUses=*/true,
+                          /*IgnoreAssumeLikeCalls=*/true,
+                          /*IgnoreLLVMUsed=*/false))
+      addEdge(externalCallingNode(), N);
+    // If F is not defined in this module, it could call anything.
+    if (F.isDeclaration() && !F.isIntrinsic())
+      addEdge(N, callsExternalNode());
+  }
+
+  // Function tables are usually initialized constants; the bodies add the
+  // functions stored at run time.
+  if (IndirectCallsOpt == IndirectCallMode::None)
+    return;
+  for (const GlobalVariable &GV : M.globals())
+    if (GV.hasInitializer() && !GV.getName().startswith("llvm."))
+      addInitializerTargets(GV.getInitializer(), Field());
+}
+
+void FlatCallGraph::addInitializerTargets(const Constant *C, Field Into) {
+  if (const Function *F = getFunctionRef(C)) {
+    Targets.push_back({getNode(F), Into});
+    return;
+  }
+  if (isa<GlobalValue>(C) || isa<BlockAddress>(C))
+    return;
+  auto *STy = isa<ConstantStruct>(C) ? cast<StructType>(C->getType()) : nullptr;
+  for (unsigned I = 0; I < C->getNumOperands(); I++)
+    if (auto *Op = dyn_cast<Constant>(C->getOperand(I)))
+      addInitializerTargets(Op, STy ? Field{STy, I} : Field());
+}
+
+void FlatCallGraph::addInstruction(int Caller, const Instruction &I,
+                                   BodyEdges &Out) const {
+  bool Resolve = IndirectCallsOpt != IndirectCallMode::None;
+  auto *Call = dyn_cast<CallBase>(&I);
+  if (Call) {
+    const Function *Callee = Call->getCalledFunction();
+    if (!Callee) {
+      Out.Edges.push_back({Caller, callsExternalNode()});
+      if (Resolve && !Call->isInlineAsm()) {
+        const Value *Op = Call->getCalledOperand();
+        // A call through a cast of a function calls that function.
+        if (const Function *F = getFunctionRef(Op))
+          Out.Edges.push_back({Caller, getNode(F)});
+        else
+          Out.IndirectCalls.push_back(
+              {Caller, Call->getFunctionType(), getLoadedField(Op)});
+      }
+    } else if (!Intrinsic::isLeaf(Callee->getIntrinsicID())) {
+      // As in CallGraph: intrinsics that may call back into the program
+      // (statepoints, patchpoints) call external code, the others nothing.
+      Out.Edges.push_back({Caller, callsExternalNode()});
+    } else if (!Callee->isIntrinsic()) {
+      Out.Edges.push_back({Caller, getNode(Callee)});
+    }
+    forEachCallbackFunction(*Call, [&](Function *CB) {
+      Out.Edges.push_back({Caller, getNode(CB)});
+    });
+  }
+  if (!Resolve)
+    return;
+
+  // The functions whose address I takes.
+  for (const Use &U : I.operands()) {
+    if (Call && Call->isCallee(&U))
+      continue;
+    const Function *F = getFunctionRef(U.get());
+    if (!F)
+      continue;
+    Field Into;
+    if (auto *SI = dyn_cast<StoreInst>(&I))
+      if (U.getOperandNo() == 0)
+        Into = getField(SI->getPointerOperand());
+    Out.Targets.push_back({getNode(F), Into});
+  }
+}
+
+void FlatCallGraph::addBody(const Function &F, BodyEdges &Out) const {
+  int Caller = getNode(&F);
+  for (const Instruction &I : instructions(F))
+    addInstruction(Caller, I, Out);
+}
+
+void FlatCallGraph::addBodyEdges(const BodyEdges &B) {
+  Edges.insert(Edges.end(), B.Edges.begin(), B.Edges.end());
+  IndirectCalls.insert(IndirectCalls.end(), B.IndirectCalls.begin(),
+                       B.IndirectCalls.end());
+  Targets.insert(Targets.end(), B.Targets.begin(), B.Targets.end());
+}
+
+// Each indirect call gets edges to one bucket of address-taken functions:
+// those of its signature or, with -hal-indirect-calls=field, those of its
+// signature stored into the field it loads the callee from. Buckets are
+// found by lookup, and a caller's edges to a bucket are added once, so the
+// edges are bounded by the callers times the bucket sizes, and the bucket
+// sizes by -hal-indirect-max-targets.
+void FlatCallGraph::resolveIndirectCalls() {
+  if (IndirectCallsOpt == IndirectCallMode::None)
+    return;
+
+  // Signatures are compared up to the pointee types: with typed pointers,
+  // the same callback is often defined with other pointer parameter types.
+  // The keys of Sigs live in Alloc.
+  DenseMap<FunctionType *, int> SigOf;
+  DenseMap<ArrayRef<uintptr_t>, int> Sigs;
+  BumpPtrAllocator Alloc;
+  SmallVector<uintptr_t, 8> Key;
+  auto GetSig = [&](FunctionType *T) {
+    auto It = SigOf.find(T);
+    if (It != SigOf.end())
+      return It->second;
+    Key.assign(1, T->isVarArg());
+    for (Type *Ty : T->subtypes()) {
+      auto *PTy = dyn_cast<PointerType>(Ty);
+      Key.push_back(PTy ? uintptr_t(PTy->getAddressSpace()) << 1 | 1
+                        : reinterpret_cast<uintptr_t>(Ty));
+    }
+    auto SigIt = Sigs.find(Key);
+    if (SigIt == Sigs.end()) {
+      uintptr_t *Stored = Alloc.Allocate<uintptr_t>(Key.size());
+      std::copy(Key.begin(), Key.end(), Stored);
+      SigIt = Sigs
+                  .insert({makeArrayRef(Stored, Key.size()),
+                           static_cast<int>(Sigs.size())})
+                  .first;
+    }
+    SigOf[T] = SigIt->second;
+    return SigIt->second;
+  };
+
+  using BucketKey = std::tuple<int, StructType *, unsigned>;
+  DenseMap<BucketKey, int> BucketIDs;
+  std::vector<std::vector<int>> Buckets;
+  auto AddToBucket = [&](const BucketKey &Key, int Node) {
+    auto It = BucketIDs.insert({Key, static_cast<int>(Buckets.size())}).first;
+    if (It->second == static_cast<int>(Buckets.size()))
+      Buckets.emplace_back();
+    Buckets[It->second].push_back(Node);
+  };
+  for (const Target &T : Targets) {
+    int Sig = GetSig(Funcs[T.Node]->getFunctionType());
+    AddToBucket(BucketKey(Sig, nullptr, 0), T.Node);
+    if (IndirectCallsOpt == IndirectCallMode::Field && T.Into.Struct)
+      AddToBucket(BucketKey(Sig, T.Into.Struct, T.Into.Index), T.Node);
+  }
+  for (std::vector<int> &Bucket : Buckets) {
+    llvm::sort(Bucket);
+    Bucket.erase(std::unique(Bucket.begin(), Bucket.end()), Bucket.end());
+  }
+
+  DenseSet<std::pair<int, int>> Resolved;
+  for (const IndirectCall &C : IndirectCalls) {
+    int Sig = GetSig(C.Type);
+    auto It = BucketIDs.end();
+    if (IndirectCallsOpt == IndirectCallMode::Field && C.From.Struct)
+      It = BucketIDs.find(BucketKey(Sig, C.From.Struct, C.From.Index));
+    if (It == BucketIDs.end())
+      It = BucketIDs.find(BucketKey(Sig, nullptr, 0));
+    if (It == BucketIDs.end() ||
+        Buckets[It->second].size() > IndirectMaxTargets ||
+        !Resolved.insert({C.Caller, It->second}).second)
+      continue;
+    for (int Callee : Buckets[It->second])
+      addEdge(C.Caller, Callee);
+  }
+  IndirectCalls.clear();
+  Targets.clear();
+}
+
+bool FlatCallGraph::resolvesIndirectCalls() {
+  return IndirectCallsOpt != IndirectCallMode::None;
+}
+
+std::string FlatCallGraph::getConfigKey() {
+  std::string Key;
+  raw_string_ostream OS(Key);
+  OS << "indirect-calls=" << static_cast<int>(IndirectCallsOpt.getValue());
+  if (IndirectCallsOpt != IndirectCallMode::None)
+    OS << " indirect-max-targets=" << IndirectMaxTargets;
+  return OS.str();
+}
@@ -0,0 +1,58 @@
+//==============================================================================
+// FILE:
+//    FunctionSummary.cpp
+//
+// DESCRIPTION:
+//    Per-function summary store shared by the modules analyzed by a process.
+//
+// License: MIT
+//==============================================================================
+#include "FunctionSummary.h"
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
+
+using namespace llvm;
+
+cl::opt<bool> HalSummaryCache(
+    "hal-summary-cache",
+    cl::desc("Reuse the classification of identical functions across the "
+             "modules analyzed by the process"),
+    cl::init(false));
+
+FunctionSummaryStore *FunctionSummaryStore::get() {
+  static FunctionSummaryStore Store;
+  return HalSummaryCache ? &Store : nullptr;
+}
+
+FunctionSummaryStore::Key FunctionSummaryStore::getKey(const Function &F) {
+  MD5 Hash;
+  auto AddString = [&Hash](StringRef S) {
+    Hash.update(S);
+    Hash.update(StringRef("", 1));
+  };
+  AddString(F.getName());
+  if (const DISubprogram *SP = F.getSubprogram()) {
+    AddString(SP->getName());
+    AddString(SP->getLinkageName());
+    AddString(SP->getDirectory());
+    AddString(SP->getFilename());
+  }
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  return Result.words();
+}
+
+FunctionSummary *FunctionSummaryStore::lookup(Key K) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Summaries.lookup(K);
+}
+
+FunctionSummary *FunctionSummaryStore::insert(Key K, bool MacroUsed) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  FunctionSummary *&S = Summaries[K];
+  if (!S)
+    S = new (Alloc) FunctionSummary(MacroUsed);
+  return S;
+}
@@ -0,0 +1,604 @@
+//==============================================================================
+// FILE:
+//    HalAgg.cpp
+//
+// DESCRIPTION:
+//    halagg: aggregates the reports of a corpus run (the <file>.analysis
+//    files written by halvd or opt, in text or JSON Lines) into NCMA counts
+//    per project and per source directory.
+//
+//    Reports are read and parsed by a pool of threads. The project of a
+//    report is the first path component under the directory it was found
+//    in (e.g. bitcode-db/<project>/...). An MMIO function is identified by
+//    its name and the location of its MMIO instruction, so vendor code
+//    linked into many applications of a project is counted once.
+//
+//    With -o, the deduplicated functions are written to a columnar summary:
+//    one little-endian array per column plus a string table, laid out as
+//    in SectionLayout.h and read in place by `halagg -summary`, so later
+//    queries do not re-read the reports.
+//
+// USAGE:
+//      halagg [-j N] [-suffix .analysis] [-o <summary>] [-by project|dir]
+//             <report or directory>...
+//      halagg -summary <summary> [-by project|dir]
+//
+// License: MIT
+//==============================================================================
+#include "SectionLayout.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+using namespace llvm;
+using layout::Section;
+using support::little32_t;
+using support::ulittle32_t;
+
+static cl::list<std::string> Inputs(cl::Positional,
+                                    cl::desc("<report or directory>..."));
+
+static cl::opt<unsigned>
+    NumThreads("j",
+               cl::desc("Reports parsed concurrently (0 = all hardware "
+                        "threads)"),
+               cl::init(0));
+
+static cl::opt<std::string>
+    Suffix("suffix", cl::desc("Suffix of the reports in directories"),
+           cl::init(".analysis"));
+
+static cl::opt<std::string> Output("o",
+                                   cl::desc("Write the columnar summary here"),
+                                   cl::value_desc("file"));
+
+static cl::opt<std::string>
+    SummaryFile("summary",
+                cl::desc("Query a columnar summary instead of reports"),
+                cl::value_desc("file"));
+
+enum class GroupBy { Project, Dir };
+
+static cl::opt<GroupBy> By(
+    "by", cl::desc("Grouping of the printed counts"),
+    cl::values(clEnumValN(GroupBy::Project, "project",
+                          "Per project, functions deduplicated within the "
+                          "project (default)"),
+               clEnumValN(GroupBy::Dir, "dir",
+                          "Per source directory, functions deduplicated "
+                          "over the corpus")),
+    cl::init(GroupBy::Project));
+
+static std::mutex ErrMutex;
+
+static void reportError(const Twine &Msg) {
+  std::lock_guard<std::mutex> Lock(ErrMutex);
+  WithColor::error(errs(), "halagg") << Msg << "\n";
+}
+
+//------------------------------------------------------------------------------
+// Reports
+//------------------------------------------------------------------------------
+namespace {
+// An MMIO function as read from a report.
+struct Record {
+  std::string Function;
+  std::string File;
+  unsigned Line = 0;
+  int TC = 0;
+  bool NCMA_CG = false;
+  bool NCMA_GroundTruth = false;
+  bool MacroUsed = false;
+};
+} // namespace
+
+// Splits "<path>:<line>[:<col>][ @[ ... ]]" as printed by print<hal-bypass>.
+static void parseLoc(StringRef Loc, Record &R) {
+  Loc = Loc.split(" @[").first.trim();
+  StringRef Rest, Last;
+  std::tie(Rest, Last) = Loc.rsplit(':');
+  unsigned Num;
+  if (Rest.empty() || Last.getAsInteger(10, Num)) {
+    R.File = Loc.str();
+    return;
+  }
+  StringRef Path, Line;
+  std::tie(Path, Line) = Rest.rsplit(':');
+  unsigned LineNum;
+  if (!Path.empty() && !Line.getAsInteger(10, LineNum)) {
+    R.File = Path.str();
+    R.Line = LineNum;
+  } else {
+    R.File = Rest.str();
+    R.Line = Num;
+  }
+}
+
+// "<Head>: <name> <loc> <tc> <cg> <truth> <macro>", where <loc> may be
+// empty or contain spaces.
+static bool parseTextLine(StringRef Line, Record &R) {
+  if (!Line.consume_front("HAL: ") && !Line.consume_front("Non-HAL: "))
+    return false;
+  StringRef Fields[4];
+  for (int I = 3; I >= 0; I--)
+    std::tie(Line, Fields[I]) = Line.rsplit(' ');
+  unsigned Flags[3];
+  if (Fields[0].getAsInteger(10, R.TC) ||
+      Fields[1].getAsInteger(10, Flags[0]) ||
+      Fields[2].getAsInteger(10, Flags[1]) ||
+      Fields[3].getAsInteger(10, Flags[2]))
+    return false;
+  R.NCMA_CG = Flags[0];
+  R.NCMA_GroundTruth = Flags[1];
+  R.MacroUsed = Flags[2];
+  StringRef Name, Loc;
+  std::tie(Name, Loc) = Line.split(' ');
+  R.Function = Name.str();
+  parseLoc(Loc, R);
+  return true;
+}
+
+static bool parseJSONLine(StringRef Line, Record &R) {
+  Expected<json::Value> V = json::parse(Line);
+  if (!V) {
+    consumeError(V.takeError());
+    return false;
+  }
+  const json::Object *O = V->getAsObject();
+  if (!O)
+    return false;
+  Optional<StringRef> Name = O->getString("function");
+  Optional<StringRef> File = O->getString("file");
+  Optional<int64_t> LineNum = O->getInteger("line");
+  Optional<int64_t> TC = O->getInteger("tc_in_degree");
+  Optional<bool> CG = O->getBoolean("ncma_cg");
+  Optional<bool> Truth = O->getBoolean("ncma_truth");
+  Optional<bool> Macro = O->getBoolean("macro");
+  if (!Name || !File || !LineNum || !TC || !CG || !Truth || !Macro)
+    return false;
+  R.Function = Name->str();
+  R.File = File->str();
+  R.Line = *LineNum;
+  R.TC = *TC;
+  R.NCMA_CG = *CG;
+  R.NCMA_GroundTruth = *Truth;
+  R.MacroUsed = *Macro;
+  return true;
+}
+
+// The records of the report in Path, in either format.
+static bool parseReport(StringRef Path, std::vector<Record> &Records) {
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer) {
+    reportError(Path + ": " + Buffer.getError().message());
+    return false;
+  }
+  StringRef Data = (*Buffer)->getBuffer();
+  bool JSONL = Data.ltrim().startswith("{");
+  SmallVector<StringRef, 0> Lines;
+  Data.split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    Line = Line.rtrim("\r");
+    Record R;
+    if (JSONL ? parseJSONLine(Line, R) : parseTextLine(Line, R)) {
+      Records.push_back(std::move(R));
+    } else if (JSONL) {
+      reportError(Path + ": malformed line: " + Line);
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Columnar summary
+//------------------------------------------------------------------------------
+namespace {
+// One row per MMIO function and project. Strings are interned: every
+// string column holds indices into the string table.
+struct Columns {
+  std::vector<ulittle32_t> Project, Function, File, Dir, Line;
+  std::vector<little32_t> MaxTC;
+  // Applications of the project the function is in, and in how many of them
+  // it is NCMA(CG).
+  std::vector<ulittle32_t> NumApps, NumNCMA_CG;
+  // Bit 0: NCMA(truth); bit 1: macro used.
+  std::vector<uint8_t> Flags;
+};
+
+struct Header {
+  char Magic[8]; // "HALAGG\0\0"
+  ulittle32_t Version;
+  ulittle32_t NumRows;
+  // String table: offsets into Blob of NUL-terminated strings.
+  Section Strings;
+  Section Blob;
+  // Per project: its name and number of reports.
+  Section ProjectNames;
+  Section ProjectApps;
+  Section Project, Function, File, Dir, Line, MaxTC, NumApps, NumNCMA_CG,
+      Flags;
+};
+
+const char Magic[8] = {'H', 'A', 'L', 'A', 'G', 'G', '\0', '\0'};
+const uint32_t Version = 1;
+enum : uint8_t { FlagTruth = 1, FlagMacro = 2 };
+
+// The reduction of reports. Each thread reduces its reports into its own
+// Aggregate; they are merged at the end.
+class Aggregate {
+public:
+  unsigned intern(StringRef S) {
+    auto Inserted = StringIDs.insert({S, Strings.size()});
+    if (Inserted.second)
+      Strings.push_back(Inserted.first->first());
+    return Inserted.first->second;
+  }
+
+  // Adds the records of one report of Project.
+  void addReport(StringRef Project, const std::vector<Record> &Records) {
+    unsigned P = intern(Project);
+    ProjectApps[P]++;
+    for (const Record &R : Records)
+      addRow(P, intern(R.Function), intern(R.File), R.Line, R.TC, 1,
+             R.NCMA_CG,
+             (R.NCMA_GroundTruth ? FlagTruth : 0) |
+                 (R.MacroUsed ? FlagMacro : 0));
+  }
+
+  void merge(const Aggregate &Other) {
+    std::vector<unsigned> IDs;
+    IDs.reserve(Other.Strings.size());
+    for (StringRef S : Other.Strings)
+      IDs.push_back(intern(S));
+    for (auto &I : Other.ProjectApps)
+      ProjectApps[IDs[I.first]] += I.second;
+    const Columns &O = Other.C;
+    for (size_t Row = 0; Row < O.Project.size(); Row++)
+      addRow(IDs[O.Project[Row]], IDs[O.Function[Row]], IDs[O.File[Row]],
+             O.Line[Row], O.MaxTC[Row], O.NumApps[Row], O.NumNCMA_CG[Row],
+             O.Flags[Row]);
+  }
+
+  StringMap<unsigned> StringIDs;
+  std::vector<StringRef> Strings;
+  std::map<unsigned, unsigned> ProjectApps;
+  DenseMap<std::tuple<unsigned, unsigned, unsigned, unsigned>, size_t> Rows;
+  Columns C;
+
+private:
+  void addRow(unsigned P, unsigned F, unsigned File, unsigned Line, int TC,
+              unsigned NumApps, unsigned NumNCMA_CG, uint8_t Flags) {
+    auto Inserted =
+        Rows.insert({std::make_tuple(P, F, File, Line), C.Project.size()});
+    size_t Row = Inserted.first->second;
+    if (Inserted.second) {
+      C.Project.push_back(ulittle32_t(P));
+      C.Function.push_back(ulittle32_t(F));
+      C.File.push_back(ulittle32_t(File));
+      C.Dir.push_back(
+          ulittle32_t(intern(sys::path::parent_path(Strings[File]))));
+      C.Line.push_back(ulittle32_t(Line));
+      C.MaxTC.push_back(little32_t(TC));
+      C.NumApps.push_back(ulittle32_t(0));
+      C.NumNCMA_CG.push_back(ulittle32_t(0));
+      C.Flags.push_back(0);
+    }
+    C.MaxTC[Row] = std::max<int>(C.MaxTC[Row], TC);
+    C.NumApps[Row] = C.NumApps[Row] + NumApps;
+    C.NumNCMA_CG[Row] = C.NumNCMA_CG[Row] + NumNCMA_CG;
+    C.Flags[Row] |= Flags;
+  }
+};
+} // namespace
+
+namespace {
+// A columnar summary, read in place or viewing an Aggregate.
+struct Summary {
+  std::unique_ptr<MemoryBuffer> Buffer;
+  ArrayRef<ulittle32_t> Offsets;
+  ArrayRef<char> Blob;
+  ArrayRef<ulittle32_t> ProjectNames, ProjectApps;
+  ArrayRef<ulittle32_t> Project, Function, File, Dir, Line;
+  ArrayRef<little32_t> MaxTC;
+  ArrayRef<ulittle32_t> NumApps, NumNCMA_CG;
+  ArrayRef<uint8_t> Flags;
+
+  StringRef getString(uint32_t ID) const {
+    return StringRef(Blob.data() + Offsets[ID]);
+  }
+};
+} // namespace
+
+static bool writeSummary(StringRef Path, const Summary &S) {
+  Header H;
+  std::memset(&H, 0, sizeof(H));
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.NumRows = S.Project.size();
+  layout::Layout L(sizeof(Header));
+  L.add(H.Strings, S.Offsets);
+  L.add(H.Blob, S.Blob);
+  L.add(H.ProjectNames, S.ProjectNames);
+  L.add(H.ProjectApps, S.ProjectApps);
+  L.add(H.Project, S.Project);
+  L.add(H.Function, S.Function);
+  L.add(H.File, S.File);
+  L.add(H.Dir, S.Dir);
+  L.add(H.Line, S.Line);
+  L.add(H.MaxTC, S.MaxTC);
+  L.add(H.NumApps, S.NumApps);
+  L.add(H.NumNCMA_CG, S.NumNCMA_CG);
+  L.add(H.Flags, S.Flags);
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (!EC) {
+    OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+    layout::writeSection(OS, S.Offsets);
+    layout::writeSection(OS, S.Blob);
+    layout::writeSection(OS, S.ProjectNames);
+    layout::writeSection(OS, S.ProjectApps);
+    layout::writeSection(OS, S.Project);
+    layout::writeSection(OS, S.Function);
+    layout::writeSection(OS, S.File);
+    layout::writeSection(OS, S.Dir);
+    layout::writeSection(OS, S.Line);
+    layout::writeSection(OS, S.MaxTC);
+    layout::writeSection(OS, S.NumApps);
+    layout::writeSection(OS, S.NumNCMA_CG);
+    layout::writeSection(OS, S.Flags);
+    OS.close();
+    EC = OS.error();
+  }
+  if (EC)
+    reportError(Path + ": " + EC.message());
+  return !EC;
+}
+
+// A section of Count elements.
+template <typename T>
+static bool getSection(StringRef Data, const Section &S, size_t Count,
+                       ArrayRef<T> &A) {
+  return S.Count == Count && layout::getSection(Data, S, A);
+}
+
+static bool readSummary(StringRef Path, Summary &S) {
+  auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+  if (!Buffer) {
+    reportError(Path + ": " + Buffer.getError().message());
+    return false;
+  }
+  StringRef Data = (*Buffer)->getBuffer();
+  const Header *H = layout::getHeader<Header>(Data, Magic);
+  if (!H || H->Version != Version) {
+    reportError(Path + ": not a halagg summary of version " + Twine(Version));
+    return false;
+  }
+  size_t NumRows = H->NumRows, NumProjects = H->ProjectNames.Count;
+  bool Valid =
+      getSection(Data, H->Strings, H->Strings.Count, S.Offsets) &&
+      getSection(Data, H->Blob, H->Blob.Count, S.Blob) &&
+      getSection(Data, H->ProjectNames, NumProjects, S.ProjectNames) &&
+      getSection(Data, H->ProjectApps, NumProjects, S.ProjectApps) &&
+      getSection(Data, H->Project, NumRows, S.Project) &&
+      getSection(Data, H->Function, NumRows, S.Function) &&
+      getSection(Data, H->File, NumRows, S.File) &&
+      getSection(Data, H->Dir, NumRows, S.Dir) &&
+      getSection(Data, H->Line, NumRows, S.Line) &&
+      getSection(Data, H->MaxTC, NumRows, S.MaxTC) &&
+      getSection(Data, H->NumApps, NumRows, S.NumApps) &&
+      getSection(Data, H->NumNCMA_CG, NumRows, S.NumNCMA_CG) &&
+      getSection(Data, H->Flags, NumRows, S.Flags);
+  // Every string ID must resolve to a NUL-terminated string.
+  Valid = Valid && layout::isStringTable(S.Blob, S.Offsets);
+  size_t NumStrings = S.Offsets.size();
+  for (ArrayRef<ulittle32_t> Column :
+       {S.ProjectNames, S.Project, S.Function, S.File, S.Dir})
+    for (uint32_t ID : Column)
+      Valid = Valid && ID < NumStrings;
+  if (!Valid) {
+    reportError(Path + ": corrupt summary");
+    return false;
+  }
+  S.Buffer = std::move(*Buffer);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Queries
+//------------------------------------------------------------------------------
+namespace {
+struct Counts {
+  unsigned Apps = 0;
+  unsigned Functions = 0;
+  unsigned NCMA_CG = 0;
+  unsigned NCMA_GroundTruth = 0;
+  unsigned MacroUsed = 0;
+};
+} // namespace
+
+// Prints the counts per group. A function counts as NCMA(CG) if it is in
+// some application of the group.
+static void printCounts(const Summary &S) {
+  std::map<StringRef, Counts> Groups;
+  if (By == GroupBy::Project) {
+    for (size_t P = 0; P < S.ProjectNames.size(); P++)
+      Groups[S.getString(S.ProjectNames[P])].Apps = S.ProjectApps[P];
+    for (size_t Row = 0; Row < S.Project.size(); Row++) {
+      Counts &C = Groups[S.getString(S.Project[Row])];
+      C.Functions++;
+      C.NCMA_CG += S.NumNCMA_CG[Row] > 0;
+      C.NCMA_GroundTruth += (S.Flags[Row] & FlagTruth) != 0;
+      C.MacroUsed += (S.Flags[Row] & FlagMacro) != 0;
+    }
+  } else {
+    // Rows are per project: deduplicate across projects first.
+    DenseMap<std::tuple<uint32_t, uint32_t, uint32_t>, size_t> Unique;
+    std::vector<std::pair<uint8_t, bool>> Merged;
+    std::vector<uint32_t> MergedDir;
+    for (size_t Row = 0; Row < S.Project.size(); Row++) {
+      auto Inserted = Unique.insert(
+          {std::make_tuple(uint32_t(S.Function[Row]), uint32_t(S.File[Row]),
+                           uint32_t(S.Line[Row])),
+           Merged.size()});
+      if (Inserted.second) {
+        Merged.push_back({0, false});
+        MergedDir.push_back(S.Dir[Row]);
+      }
+      auto &M = Merged[Inserted.first->second];
+      M.first |= S.Flags[Row];
+      M.second |= S.NumNCMA_CG[Row] > 0;
+    }
+    for (size_t I = 0; I < Merged.size(); I++) {
+      Counts &C = Groups[S.getString(MergedDir[I])];
+      C.Functions++;
+      C.NCMA_CG += Merged[I].second;
+      C.NCMA_GroundTruth += (Merged[I].first & FlagTruth) != 0;
+      C.MacroUsed += (Merged[I].first & FlagMacro) != 0;
+    }
+  }
+
+  bool ByProject = By == GroupBy::Project;
+  outs() << (ByProject ? "project\tapps" : "dir")
+         << "\tfunctions\tncma_cg\tncma_truth\tmacro\n";
+  for (auto &G : Groups) {
+    outs() << G.first;
+    if (ByProject)
+      outs() << "\t" << G.second.Apps;
+    outs() << "\t" << G.second.Functions << "\t" << G.second.NCMA_CG << "\t"
+           << G.second.NCMA_GroundTruth << "\t" << G.second.MacroUsed << "\n";
+  }
+}
+
+// The same view of an in-memory aggregate.
+static Summary getSummary(const Aggregate &A,
+                          std::vector<ulittle32_t> &Offsets,
+                          std::vector<char> &Blob,
+                          std::vector<ulittle32_t> &Names,
+                          std::vector<ulittle32_t> &Apps) {
+  for (StringRef Str : A.Strings) {
+    Offsets.push_back(ulittle32_t(Blob.size()));
+    Blob.insert(Blob.end(), Str.begin(), Str.end());
+    Blob.push_back('\0');
+  }
+  for (auto &I : A.ProjectApps) {
+    Names.push_back(ulittle32_t(I.first));
+    Apps.push_back(ulittle32_t(I.second));
+  }
+  Summary S;
+  S.Offsets = Offsets;
+  S.Blob = Blob;
+  S.ProjectNames = Names;
+  S.ProjectApps = Apps;
+  S.Project = A.C.Project;
+  S.Function = A.C.Function;
+  S.File = A.C.File;
+  S.Dir = A.C.Dir;
+  S.Line = A.C.Line;
+  S.MaxTC = A.C.MaxTC;
+  S.NumApps = A.C.NumApps;
+  S.NumNCMA_CG = A.C.NumNCMA_CG;
+  S.Flags = A.C.Flags;
+  return S;
+}
+
+//------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------
+// Adds the reports under Input with their projects.
+static void addInput(StringRef Input,
+                     std::vector<std::pair<std::string, std::string>> &Reports) {
+  if (!sys::fs::is_directory(Input)) {
+    Reports.push_back(
+        {Input.str(), sys::path::filename(sys::path::parent_path(Input)).str()});
+    return;
+  }
+  std::error_code EC;
+  for (sys::fs::recursive_directory_iterator I(Input, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    StringRef Path = I->path();
+    if (!Path.endswith(Suffix) || sys::fs::is_directory(Path))
+      continue;
+    StringRef Rel = Path.drop_front(Input.size()).ltrim("/\\");
+    StringRef Project = Rel.split('/').first;
+    if (Project == Rel)
+      Project = sys::path::filename(Input);
+    Reports.push_back({Path.str(), Project.str()});
+  }
+  if (EC)
+    reportError(Input + ": " + EC.message());
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "HAL bypass report aggregator\n");
+
+  if (!SummaryFile.empty()) {
+    Summary S;
+    if (!readSummary(SummaryFile, S))
+      return 1;
+    printCounts(S);
+    return 0;
+  }
+
+  std::vector<std::pair<std::string, std::string>> Reports;
+  for (const std::string &Input : Inputs)
+    addInput(Input, Reports);
+  if (Reports.empty()) {
+    reportError("no reports");
+    return 1;
+  }
+
+  std::atomic<size_t> Next(0);
+  std::atomic<unsigned> NumFailed(0);
+  ThreadPool Pool(hardware_concurrency(NumThreads));
+  std::vector<Aggregate> Partial(Pool.getThreadCount());
+  for (Aggregate &P : Partial)
+    Pool.async([&] {
+      std::vector<Record> Records;
+      for (size_t I; (I = Next++) < Reports.size();) {
+        Records.clear();
+        if (!parseReport(Reports[I].first, Records)) {
+          NumFailed++;
+          continue;
+        }
+        P.addReport(Reports[I].second, Records);
+      }
+    });
+  Pool.wait();
+  Aggregate A;
+  for (const Aggregate &P : Partial)
+    A.merge(P);
+
+  std::vector<ulittle32_t> Offsets, Names, Apps;
+  std::vector<char> Blob;
+  Summary S = getSummary(A, Offsets, Blob, Names, Apps);
+  if (!Output.empty() && !writeSummary(Output, S))
+    return 1;
+  printCounts(S);
+  if (NumFailed) {
+    reportError(Twine(NumFailed.load()) + " of " + Twine(Reports.size()) +
+                " reports failed");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,283 @@
+//==============================================================================
+// FILE:
+//    HalRules.cpp
+//
+// DESCRIPTION:
+//    Pattern rules used to classify MMIO functions. The rule file is parsed
+//    and every rule set compiled once per process. Matching a text is a single
+//    scan of an Aho-Corasick automaton over the literal prefixes of the
+//    patterns; the regular expressions only run at the candidate positions it
+//    reports.
+//
+// License: MIT
+//==============================================================================
+#include "HalRules.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+#include <queue>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+    HalRulesFile("hal-rules",
+                 cl::desc("Pattern rule file (default: the built-in "
+                          "rules/default.rules)"),
+                 cl::value_desc("filename"));
+
+// Generated from rules/default.rules: static const char DefaultRules[].
+#include "DefaultRules.inc"
+
+//------------------------------------------------------------------------------
+// PatternSet Implementation
+//------------------------------------------------------------------------------
+// The literal string every match of Pattern starts with, or "" if there is
+// none, e.g. because of a top-level alternation.
+static std::string literalPrefix(StringRef Pattern) {
+  int Depth = 0;
+  bool InClass = false;
+  for (size_t I = 0; I < Pattern.size(); I++) {
+    char C = Pattern[I];
+    if (C == '\\') {
+      I++;
+    } else if (InClass) {
+      InClass = C != ']';
+    } else if (C == '[') {
+      InClass = true;
+    } else if (C == '(') {
+      Depth++;
+    } else if (C == ')') {
+      Depth--;
+    } else if (C == '|' && Depth == 0) {
+      return "";
+    }
+  }
+
+  std::string Prefix;
+  for (size_t I = 0; I < Pattern.size();) {
+    char C = Pattern[I];
+    size_t Next = I + 1;
+    if (C == '\\') {
+      // An escaped punctuation character is a literal; \d, \w, ... are not.
+      if (Next == Pattern.size() || isAlnum(Pattern[Next]))
+        break;
+      C = Pattern[Next++];
+    } else if (StringRef("^$.|?*+()[]{}").contains(C)) {
+      break;
+    }
+    // A character that is optional or repeated ends the prefix.
+    if (Next < Pattern.size() && StringRef("?*{").contains(Pattern[Next]))
+      break;
+    Prefix += C;
+    I = Next;
+  }
+  return Prefix;
+}
+
+bool PatternSet::add(StringRef Pattern, std::string &Err) {
+  std::string Anchored = "(?:" + Pattern.str() + ")";
+  if (Kind == Word)
+    Anchored += "(?:$|[^[:alpha:]])";
+  auto Flags = std::regex::ECMAScript | std::regex::optimize;
+  if (IgnoreCase)
+    Flags |= std::regex::icase;
+  try {
+    Rules.push_back({literalPrefix(Pattern), std::regex(Anchored, Flags)});
+  } catch (const std::regex_error &E) {
+    Err = "invalid pattern '" + Pattern.str() + "': " + E.what();
+    return false;
+  }
+  Patterns.push_back(Pattern.str());
+  return true;
+}
+
+void PatternSet::compile() {
+  auto Flags = std::regex::ECMAScript | std::regex::optimize;
+  if (IgnoreCase)
+    Flags |= std::regex::icase;
+  std::string Alternation;
+  for (auto &P : Patterns)
+    Alternation += (Alternation.empty() ? "(?:" : "|(?:") + P + ")";
+  Combined = std::regex(Alternation, Flags);
+
+  // Trie of the prefixes.
+  Unprefixed.clear();
+  Delta.assign(256, -1);
+  Out.assign(1, {});
+  for (unsigned R = 0; R < Rules.size(); R++) {
+    if (Rules[R].Prefix.empty()) {
+      Unprefixed.push_back(R);
+      continue;
+    }
+    int State = 0;
+    for (char C : Rules[R].Prefix) {
+      unsigned char Byte = IgnoreCase ? toLower(C) : C;
+      int &Next = Delta[State * 256 + Byte];
+      if (Next == -1) {
+        Next = static_cast<int>(Out.size());
+        Out.emplace_back();
+        Delta.resize(Delta.size() + 256, -1);
+      }
+      State = Delta[State * 256 + Byte];
+    }
+    Out[State].push_back(R);
+  }
+
+  // Failure links, folded into a complete transition table (BFS order, so
+  // that the failure state of a state is always finished before it).
+  std::vector<int> Fail(Out.size(), 0);
+  std::queue<int> BFSQueue;
+  for (int Byte = 0; Byte < 256; Byte++) {
+    int &Next = Delta[Byte];
+    if (Next == -1) {
+      Next = 0;
+      continue;
+    }
+    BFSQueue.push(Next);
+  }
+  while (!BFSQueue.empty()) {
+    int State = BFSQueue.front();
+    BFSQueue.pop();
+    for (int Byte = 0; Byte < 256; Byte++) {
+      int &Next = Delta[State * 256 + Byte];
+      int FailNext = Delta[Fail[State] * 256 + Byte];
+      if (Next == -1) {
+        Next = FailNext;
+        continue;
+      }
+      Fail[Next] = FailNext;
+      Out[Next].insert(Out[Next].end(), Out[FailNext].begin(),
+                       Out[FailNext].end());
+      BFSQueue.push(Next);
+    }
+  }
+}
+
+bool PatternSet::verify(const Rule &R, StringRef Text, size_t Pos) const {
+  if (Kind == Word && Pos > 0 && isAlpha(Text[Pos - 1]))
+    return false;
+  return std::regex_search(Text.begin() + Pos, Text.end(), R.Anchored,
+                           std::regex_constants::match_continuous);
+}
+
+bool PatternSet::matches(StringRef Text) const {
+  for (unsigned R : Unprefixed)
+    for (size_t Pos = 0; Pos <= Text.size(); Pos++)
+      if (verify(Rules[R], Text, Pos))
+        return true;
+
+  if (Out.empty())
+    return false;
+  int State = 0;
+  for (size_t I = 0; I < Text.size(); I++) {
+    unsigned char Byte = IgnoreCase ? toLower(Text[I]) : Text[I];
+    State = Delta[State * 256 + Byte];
+    for (unsigned R : Out[State])
+      if (verify(Rules[R], Text, I + 1 - Rules[R].Prefix.size()))
+        return true;
+  }
+  return false;
+}
+
+std::string PatternSet::strip(StringRef Text) const {
+  if (!matches(Text))
+    return Text.str();
+  return std::regex_replace(Text.str(), Combined, "");
+}
+
+//------------------------------------------------------------------------------
+// HalRules Implementation
+//------------------------------------------------------------------------------
+HalRules::HalRules()
+    : Strip(PatternSet::Anywhere, false),
+      HalExclude(PatternSet::Anywhere, true), Hal(PatternSet::Word, true),
+      HalFull(PatternSet::Word, true), IgnorePath(PatternSet::Anywhere, true),
+      IgnoreFunc(PatternSet::Anywhere, false) {}
+
+const HalRules &HalRules::get() {
+  static const HalRules Rules = [] {
+    HalRules R;
+    std::string Err;
+    if (HalRulesFile.empty()) {
+      if (!R.parse(DefaultRules, Err))
+        report_fatal_error(Twine("built-in HAL rules: ") + Err, false);
+      return R;
+    }
+    auto Buffer = MemoryBuffer::getFile(HalRulesFile);
+    if (!Buffer)
+      report_fatal_error(Twine("cannot read ") + HalRulesFile + ": " +
+                             Buffer.getError().message(),
+                         false);
+    if (!R.parse((*Buffer)->getBuffer(), Err))
+      report_fatal_error(Twine(HalRulesFile) + ": " + Err, false);
+    return R;
+  }();
+  return Rules;
+}
+
+bool HalRules::parse(StringRef Buffer, std::string &Err) {
+  SmallVector<StringRef, 64> Lines;
+  Buffer.split(Lines, '\n');
+  for (size_t I = 0; I < Lines.size(); I++) {
+    StringRef Line = Lines[I].trim();
+    if (Line.empty() || Line.startswith("#"))
+      continue;
+    StringRef Kind, Pattern;
+    std::tie(Kind, Pattern) = Line.split(' ');
+    Pattern = Pattern.trim();
+
+    SmallVector<PatternSet *, 2> Sets;
+    if (Kind == "strip")
+      Sets.push_back(&Strip);
+    else if (Kind == "hal-exclude")
+      Sets.push_back(&HalExclude);
+    else if (Kind == "hal")
+      Sets.append({&Hal, &HalFull});
+    else if (Kind == "hal-project")
+      Sets.push_back(&HalFull);
+    else if (Kind == "ignore-path")
+      Sets.push_back(&IgnorePath);
+    else if (Kind == "ignore-func")
+      Sets.push_back(&IgnoreFunc);
+    else {
+      Err = "line " + std::to_string(I + 1) + ": unknown rule kind '" +
+            Kind.str() + "'";
+      return false;
+    }
+    if (Pattern.empty()) {
+      Err = "line " + std::to_string(I + 1) + ": missing pattern";
+      return false;
+    }
+    for (PatternSet *S : Sets) {
+      if (!S->add(Pattern, Err)) {
+        Err = "line " + std::to_string(I + 1) + ": " + Err;
+        return false;
+      }
+    }
+  }
+
+  for (PatternSet *S : {&Strip, &HalExclude, &Hal, &HalFull, &IgnorePath,
+                        &IgnoreFunc})
+    S->compile();
+  Hash = xxHash64(Buffer);
+  return true;
+}
+
+bool HalRules::isHalName(StringRef Name, bool Full) const {
+  std::string Stripped = Strip.strip(Name);
+  if (HalExclude.matches(Stripped))
+    return false;
+  return (Full ? HalFull : Hal).matches(Stripped);
+}
+
+bool HalRules::isIgnoredPath(StringRef Path) const {
+  return IgnorePath.matches(Path);
+}
+
+bool HalRules::isIgnoredFunc(StringRef Name) const {
+  return IgnoreFunc.matches(Name);
+}
@@ -0,0 +1,96 @@
+//==============================================================================
+// FILE:
+//    HalSnap.cpp
+//
+// DESCRIPTION:
+//    halsnap: queries a snapshot written with -hal-snapshot, without the
+//    bitcode or the plugins. By default, prints the MMIO functions in the
+//    format of print<hal-bypass>. With -callers, prints the transitive
+//    callers of a function instead.
+//
+// USAGE:
+//      halsnap [-callers <function>] <snapshot>
+//
+// License: MIT
+//==============================================================================
+#include "HalSnapshot.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/WithColor.h"
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> Input(cl::Positional, cl::Required,
+                                  cl::desc("<snapshot>"));
+
+static cl::opt<std::string>
+    Callers("callers",
+            cl::desc("Print the transitive callers of this function"),
+            cl::value_desc("function"));
+
+static void printMMIOFuncs(const HalSnapshot &S) {
+  outs() << "# nodes=" << S.numNodes() << " edges=" << S.numEdges()
+         << " MMIO functions=" << S.mmioFuncs().size() << "\n";
+  outs() << "Function, Location of MMIO inst, TC In-degree, NCMA(CG), "
+            "NCMA(truth), Macro\n";
+  for (const halsnap::MMIOFunc &MF : S.mmioFuncs()) {
+    outs() << (MF.NCMA_GroundTruth ? "Non-HAL" : "HAL") << ": "
+           << S.getName(MF.Node) << " ";
+    if (MF.LocFileID >= 0) {
+      outs() << S.getPath(MF.LocFileID) << ':' << MF.Line;
+      if (MF.Col != 0)
+        outs() << ':' << MF.Col;
+    }
+    outs() << " " << MF.TransClosureInDeg << " " << unsigned(MF.NCMA_CG)
+           << " " << unsigned(MF.NCMA_GroundTruth) << " "
+           << unsigned(MF.MacroUsed) << "\n";
+  }
+}
+
+static bool printCallers(const HalSnapshot &S, StringRef Name) {
+  int Start = S.findNode(Name);
+  if (Start < 0) {
+    WithColor::error(errs(), "halsnap") << "no function named " << Name
+                                        << "\n";
+    return false;
+  }
+  BitVector Visited(S.numNodes());
+  std::vector<unsigned> Worklist = {unsigned(Start)};
+  Visited.set(Start);
+  std::vector<unsigned> Found;
+  while (!Worklist.empty()) {
+    unsigned V = Worklist.back();
+    Worklist.pop_back();
+    for (uint32_t U : S.preds(V)) {
+      if (Visited.test(U))
+        continue;
+      Visited.set(U);
+      Found.push_back(U);
+      Worklist.push_back(U);
+    }
+  }
+  outs() << "# transitive callers of " << Name << ": " << Found.size()
+         << "\n";
+  for (unsigned U : Found)
+    outs() << S.getName(U) << "\n";
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "HAL bypass snapshot query\n");
+
+  Expected<std::unique_ptr<HalSnapshot>> S = HalSnapshot::open(Input);
+  if (!S) {
+    WithColor::error(errs(), "halsnap")
+        << Input << ": " << toString(S.takeError()) << "\n";
+    return 1;
+  }
+  if (!Callers.empty())
+    return printCallers(**S, Callers) ? 0 : 1;
+  printMMIOFuncs(**S);
+  return 0;
+}
@@ -0,0 +1,162 @@
+//==============================================================================
+// FILE:
+//    HalSnapshot.cpp
+//
+// DESCRIPTION:
+//    Writer and zero-copy reader of FindHALBypass snapshots (see
+//    HalSnapshot.h). Only depends on LLVMSupport, so that tools reading
+//    snapshots need neither the plugins nor the IR libraries.
+//
+// License: MIT
+//==============================================================================
+#include "HalSnapshot.h"
+
+#include <cstring>
+
+using namespace llvm;
+using namespace halsnap;
+
+static const char Magic[8] = {'H', 'A', 'L', 'S', 'N', 'A', 'P', '\0'};
+
+//------------------------------------------------------------------------------
+// Writer
+//------------------------------------------------------------------------------
+void halsnap::write(raw_ostream &OS, const CallGraphCSR &G,
+                    ArrayRef<StringRef> NodeNames, ArrayRef<StringRef> Paths,
+                    ArrayRef<MMIOFunc> MMIOFuncs) {
+  unsigned NumNodes = G.numNodes();
+  std::vector<ulittle32_t> Offsets, Targets, ROffsets, RTargets;
+  Offsets.reserve(NumNodes + 1);
+  ROffsets.reserve(NumNodes + 1);
+  Targets.reserve(G.numEdges());
+  RTargets.reserve(G.numEdges());
+  for (unsigned N = 0; N < NumNodes; N++) {
+    Offsets.push_back(ulittle32_t(Targets.size()));
+    for (int V : G.succs(N))
+      Targets.push_back(ulittle32_t(V));
+    ROffsets.push_back(ulittle32_t(RTargets.size()));
+    for (int U : G.preds(N))
+      RTargets.push_back(ulittle32_t(U));
+  }
+  Offsets.push_back(ulittle32_t(Targets.size()));
+  ROffsets.push_back(ulittle32_t(RTargets.size()));
+
+  std::string Strings;
+  auto AddString = [&Strings](StringRef S) {
+    ulittle32_t Offset(Strings.size());
+    Strings.append(S.begin(), S.end());
+    Strings.push_back('\0');
+    return Offset;
+  };
+  std::vector<ulittle32_t> NameOffsets, PathOffsets;
+  NameOffsets.reserve(NumNodes);
+  for (StringRef Name : NodeNames)
+    NameOffsets.push_back(AddString(Name));
+  PathOffsets.reserve(Paths.size());
+  for (StringRef Path : Paths)
+    PathOffsets.push_back(AddString(Path));
+
+  Header H;
+  std::memset(&H, 0, sizeof(H));
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.NumNodes = NumNodes;
+  ArrayRef<char> StringBlob(Strings.data(), Strings.size());
+  layout::Layout L(sizeof(Header));
+  L.add(H.Offsets, makeArrayRef(Offsets));
+  L.add(H.Targets, makeArrayRef(Targets));
+  L.add(H.ROffsets, makeArrayRef(ROffsets));
+  L.add(H.RTargets, makeArrayRef(RTargets));
+  L.add(H.NodeNames, makeArrayRef(NameOffsets));
+  L.add(H.Paths, makeArrayRef(PathOffsets));
+  L.add(H.MMIOFuncs, MMIOFuncs);
+  L.add(H.Strings, StringBlob);
+
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+  for (ArrayRef<ulittle32_t> A :
+       {makeArrayRef(Offsets), makeArrayRef(Targets), makeArrayRef(ROffsets),
+        makeArrayRef(RTargets), makeArrayRef(NameOffsets),
+        makeArrayRef(PathOffsets)})
+    layout::writeSection(OS, A);
+  layout::writeSection(OS, MMIOFuncs);
+  layout::writeSection(OS, StringBlob);
+}
+
+//------------------------------------------------------------------------------
+// Reader
+//------------------------------------------------------------------------------
+static Error makeError(const Twine &Msg) {
+  return createStringError(inconvertibleErrorCode(), Msg);
+}
+
+Expected<std::unique_ptr<HalSnapshot>> HalSnapshot::open(StringRef Path) {
+  auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return errorCodeToError(Buffer.getError());
+  return open(std::move(*Buffer));
+}
+
+Expected<std::unique_ptr<HalSnapshot>>
+HalSnapshot::open(std::unique_ptr<MemoryBuffer> Buffer) {
+  std::unique_ptr<HalSnapshot> S(new HalSnapshot());
+  StringRef Data = Buffer->getBuffer();
+  S->H = layout::getHeader<Header>(Data, Magic);
+  if (!S->H)
+    return makeError("not a HAL snapshot");
+  if (reinterpret_cast<uintptr_t>(Data.data()) % alignof(uint32_t))
+    return makeError("misaligned buffer");
+  if (S->H->Version != Version)
+    return makeError("unsupported HAL snapshot version " +
+                     Twine(S->H->Version) + " (expected " + Twine(Version) +
+                     ")");
+  const Header &H = *S->H;
+  if (!layout::getSection(Data, H.Offsets, S->Offsets) ||
+      !layout::getSection(Data, H.Targets, S->Targets) ||
+      !layout::getSection(Data, H.ROffsets, S->ROffsets) ||
+      !layout::getSection(Data, H.RTargets, S->RTargets) ||
+      !layout::getSection(Data, H.NodeNames, S->NodeNames) ||
+      !layout::getSection(Data, H.Paths, S->Paths) ||
+      !layout::getSection(Data, H.MMIOFuncs, S->MMIOFuncs) ||
+      !layout::getSection(Data, H.Strings, S->Strings))
+    return makeError("section out of bounds");
+  S->Buffer = std::move(Buffer);
+  if (Error E = S->validate())
+    return std::move(E);
+  return std::move(S);
+}
+
+// Checks everything the accessors rely on, so that they need no checks.
+Error HalSnapshot::validate() const {
+  unsigned NumNodes = H->NumNodes;
+  if (Offsets.size() != NumNodes + 1 || ROffsets.size() != NumNodes + 1 ||
+      NodeNames.size() != NumNodes)
+    return makeError("node count mismatch");
+  for (auto CSR : {std::make_pair(Offsets, Targets),
+                   std::make_pair(ROffsets, RTargets)}) {
+    if (CSR.first[0] != 0 || CSR.first[NumNodes] != CSR.second.size())
+      return makeError("corrupt call graph");
+    for (unsigned N = 0; N < NumNodes; N++)
+      if (CSR.first[N] > CSR.first[N + 1])
+        return makeError("corrupt call graph");
+    for (uint32_t V : CSR.second)
+      if (V >= NumNodes)
+        return makeError("corrupt call graph");
+  }
+  if (!layout::isStringTable(Strings, NodeNames) ||
+      !layout::isStringTable(Strings, Paths))
+    return makeError("corrupt string table");
+  for (const MMIOFunc &MF : MMIOFuncs)
+    if (MF.Node >= NumNodes || MF.FileID >= Paths.size() ||
+        MF.DirID >= Paths.size() || MF.LocFileID < -1 ||
+        MF.LocFileID >= int(Paths.size()))
+      return makeError("corrupt MMIO function record");
+  return Error::success();
+}
+
+int HalSnapshot::findNode(StringRef Name) const {
+  for (unsigned N = 0; N < numNodes(); N++)
+    if (getName(N) == Name)
+      return N;
+  return -1;
+}
@@ -0,0 +1,620 @@
+//==============================================================================
+// FILE:
+//    HalVD.cpp
+//
+// DESCRIPTION:
+//    halvd: runs print<hal-bypass> on many bitcode files in one process, so
+//    that the plugins are loaded and the rules compiled only once. Each input
+//    file gets its report in <file>.analysis, like run.sh produces with one
+//    `opt` per file.
+//
+//    Files are analyzed by a pool of threads, each file in its own
+//    LLVMContext. The largest files are handed out first so that a huge
+//    module does not start last and hold up the end of the run. With
+//    -mem-budget, a file is only started while the estimated size of the
+//    modules being analyzed stays within the budget (a file over the budget
+//    runs alone).
+//
+//    With -cache-dir, reports are also stored in a cache keyed by the
+//    contents of the input and FindHALBypass::getConfigKey(). An input whose
+//    key is in the cache gets the cached report without its IR being parsed.
+//    Entries are pruned with the LLVM cache pruning policy (-cache-policy,
+//    as for the ThinLTO cache), so that stale entries expire.
+//
+//    With -lazy, bitcode is loaded lazily (the file is memory-mapped) and
+//    FindHALBypass::runOnLazyModule materializes one function at a time,
+//    keeping only the bodies of MMIO functions. With -summary-callgraph, the
+//    call edges are taken from the ThinLTO summary of the input instead of
+//    from the function bodies. An input without a summary is analyzed from
+//    its IR once, and its summary written to <file>.thinlto.bc for the next
+//    runs. The GUIDs of its MMIO functions go to <file>.mmiofuncs, so that
+//    the runs with a summary only materialize those functions.
+//
+//    With -whole-program, the inputs are the units (translation units or
+//    libraries) of a single program. Each unit is loaded lazily in its own
+//    LLVMContext and its call edges are streamed into a UnionCallGraph,
+//    which resolves non-local functions by name; the IR is never linked.
+//    Units are merged in input order once all are read, so the report does
+//    not depend on which thread finishes first. One report, over the union
+//    call graph, is written to the given file.
+//
+// USAGE:
+//      halvd [-j N] [-mem-budget MiB] [-file-list <file>] [-cache-dir <dir>]
+//            [-whole-program <file>] [plugin options] <file or directory>...
+//    Directories are searched recursively for *.bc and *.ll files, taken in
+//    path order.
+//
+// License: MIT
+//==============================================================================
+#include "FindHALBypass.h"
+#include "FindMMIOFunc.h"
+#include "UnionCallGraph.h"
+
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/WithColor.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(cl::Positional,
+                                    cl::desc("<file or directory>..."));
+
+static cl::opt<std::string>
+    FileList("file-list", cl::desc("File listing input paths, one per line"),
+             cl::value_desc("filename"));
+
+static cl::opt<unsigned>
+    NumThreads("j",
+               cl::desc("Files analyzed concurrently (0 = all hardware "
+                        "threads)"),
+               cl::init(0));
+
+static cl::opt<unsigned> MemBudgetMiB(
+    "mem-budget",
+    cl::desc("Estimated memory, in MiB, that the modules being analyzed may "
+             "use together (0 = unlimited)"),
+    cl::init(0));
+
+static cl::opt<std::string>
+    OutSuffix("suffix",
+              cl::desc("Appended to an input path to name its report"),
+              cl::init(".analysis"));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir", cl::desc("Directory of the report cache (default: "
+                                   "no cache)"),
+             cl::value_desc("directory"));
+
+static cl::opt<std::string> CachePolicy(
+    "cache-policy",
+    cl::desc("Pruning policy of the report cache, e.g. "
+             "prune_after=168h:cache_size_bytes=1g (default: LLVM's)"),
+    cl::value_desc("policy"));
+
+static cl::opt<bool> LazyLoad(
+    "lazy",
+    cl::desc("Load function bodies one at a time and keep only those of "
+             "MMIO functions (bounds memory use on large modules)"),
+    cl::init(false));
+
+static cl::opt<bool> SummaryCallGraph(
+    "summary-callgraph",
+    cl::desc("Take call edges from the ThinLTO summary of the input (or from "
+             "<file>.thinlto.bc, written on first use) instead of the IR; "
+             "implies -lazy"),
+    cl::init(false));
+
+static cl::opt<std::string> WholeProgram(
+    "whole-program",
+    cl::desc("Analyze the inputs as the units of one program, over the "
+             "union of their call graphs, and write the report to <file>"),
+    cl::value_desc("file"));
+
+static cl::opt<FindHALBypassPrinter::Format> ReportFormat(
+    "report-format", cl::desc("Format of the reports"),
+    cl::values(clEnumValN(FindHALBypassPrinter::Format::Text, "text",
+                          "As print<hal-bypass> (default)"),
+               clEnumValN(FindHALBypassPrinter::Format::JSONL, "jsonl",
+                          "One JSON object per MMIO function and line")),
+    cl::init(FindHALBypassPrinter::Format::Text));
+
+// Sidecar file holding the summary of an input without one.
+static const char SummarySuffix[] = ".thinlto.bc";
+// Sidecar file listing the GUIDs of the MMIO functions of an input, so that
+// the runs using its summary only read their bodies.
+static const char CandidatesSuffix[] = ".mmiofuncs";
+
+// FindHALBypass::getConfigKey() of this run.
+static std::string ConfigKey;
+
+// Serializes diagnostics of the worker threads.
+static std::mutex ErrMutex;
+
+static void reportError(const Twine &Msg) {
+  std::lock_guard<std::mutex> Lock(ErrMutex);
+  WithColor::error(errs(), "halvd") << Msg << "\n";
+}
+
+// Estimated memory footprint of the module in a file of the given size.
+// Loaded bitcode takes roughly ten times its file size; textual IR is larger
+// than the module it describes.
+static uint64_t estimateCost(StringRef Path, uint64_t Size) {
+  return Path.endswith(".ll") ? 2 * Size : 10 * Size;
+}
+
+namespace {
+// An input file and its position among the inputs, which orders the units
+// of -whole-program.
+struct InputFile {
+  std::string Path;
+  unsigned Position;
+};
+} // namespace
+
+// Returns false if some input could not be added. The files of a directory
+// are added in path order, whatever the order of the file system.
+static bool addInput(StringRef Path,
+                     std::multimap<uint64_t, InputFile> &Files) {
+  bool Success = true;
+  auto AddFile = [&Files, &Success](StringRef File) {
+    uint64_t Size;
+    if (std::error_code EC = sys::fs::file_size(File, Size)) {
+      reportError(File + ": " + EC.message());
+      Success = false;
+      return;
+    }
+    unsigned Position = Files.size();
+    Files.insert({estimateCost(File, Size), {File.str(), Position}});
+  };
+
+  if (!sys::fs::is_directory(Path)) {
+    AddFile(Path);
+    return Success;
+  }
+  std::vector<std::string> Found;
+  std::error_code EC;
+  for (sys::fs::recursive_directory_iterator I(Path, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    StringRef File = I->path();
+    if ((File.endswith(".bc") || File.endswith(".ll")) &&
+        !File.endswith(SummarySuffix) && !sys::fs::is_directory(File))
+      Found.push_back(File.str());
+  }
+  if (EC) {
+    reportError(Path + ": " + EC.message());
+    Success = false;
+  }
+  llvm::sort(Found);
+  for (const std::string &File : Found)
+    AddFile(File);
+  return Success;
+}
+
+namespace {
+// Hands out the input files, largest first, within the memory budget.
+class Scheduler {
+public:
+  Scheduler(std::multimap<uint64_t, InputFile> Files, uint64_t Budget)
+      : Pending(std::move(Files)), Budget(Budget) {}
+
+  // Waits for the largest pending file that fits in the budget and removes
+  // it. Returns false when no file is left.
+  bool take(InputFile &File, uint64_t &Cost) {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    while (!Pending.empty()) {
+      auto It = Pending.end();
+      if (Budget && Running) {
+        It = Pending.upper_bound(InUse < Budget ? Budget - InUse : 0);
+        if (It == Pending.begin()) {
+          Released.wait(Lock);
+          continue;
+        }
+      }
+      --It;
+      Cost = It->first;
+      File = std::move(It->second);
+      Pending.erase(It);
+      InUse += Cost;
+      Running++;
+      return true;
+    }
+    return false;
+  }
+
+  void release(uint64_t Cost) {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      InUse -= Cost;
+      Running--;
+    }
+    Released.notify_all();
+  }
+
+private:
+  std::mutex Mutex;
+  std::condition_variable Released;
+  // Files by estimated cost.
+  std::multimap<uint64_t, InputFile> Pending;
+  uint64_t Budget;
+  uint64_t InUse = 0;
+  unsigned Running = 0;
+};
+} // namespace
+
+static bool writeFile(StringRef Path, StringRef Contents) {
+  std::error_code EC;
+  raw_fd_ostream Out(Path, EC, sys::fs::OF_Text);
+  if (!EC) {
+    Out << Contents;
+    Out.close();
+    EC = Out.error();
+  }
+  if (EC)
+    reportError(Path + ": " + EC.message());
+  return !EC;
+}
+
+static std::string getCachePath(StringRef Input) {
+  MD5 Hash;
+  Hash.update(ConfigKey);
+  // Call edges from a summary may differ in corner cases (callbacks).
+  Hash.update(SummaryCallGraph ? " summary-callgraph" : "");
+  Hash.update(ReportFormat == FindHALBypassPrinter::Format::JSONL ? " jsonl"
+                                                                   : "");
+  Hash.update(StringRef("", 1));
+  Hash.update(Input);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<128> Path(CacheDir);
+  // pruneCache() only considers files named llvmcache-*.
+  sys::path::append(Path, "llvmcache-" + Result.digest());
+  return std::string(Path);
+}
+
+// Reads a cache entry and marks it as used, for pruning.
+static bool readCache(const std::string &CachePath, std::string &Report) {
+  auto Buffer = MemoryBuffer::getFile(CachePath);
+  if (!Buffer)
+    return false;
+  Report = std::string((*Buffer)->getBuffer());
+  int FD;
+  if (!sys::fs::openFileForReadWrite(CachePath, FD, sys::fs::CD_OpenExisting,
+                                     sys::fs::OF_None)) {
+    sys::fs::setLastAccessAndModificationTime(
+        FD, sys::toTimePoint(std::time(nullptr)));
+    sys::Process::SafelyCloseFileDescriptor(FD);
+  }
+  return true;
+}
+
+// Writes to a temporary file renamed into place, so that concurrent runs
+// sharing the cache never read a partial entry.
+static void writeCache(const std::string &CachePath, StringRef Report) {
+  SmallString<128> TmpPath;
+  int FD;
+  if (sys::fs::createUniqueFile(CacheDir + "/tmp-%%%%%%%%", FD, TmpPath))
+    return;
+  {
+    raw_fd_ostream Out(FD, /*shouldClose=*/true);
+    Out << Report;
+  }
+  if (sys::fs::rename(TmpPath, CachePath))
+    sys::fs::remove(TmpPath);
+}
+
+// Whether the sidecar file of Path with Suffix is not older than Path.
+static bool isSidecarFresh(StringRef Path, StringRef Suffix) {
+  sys::fs::file_status Input, Sidecar;
+  return !sys::fs::status(Path, Input) &&
+         !sys::fs::status(Path + Suffix, Sidecar) &&
+         Sidecar.getLastModificationTime() >= Input.getLastModificationTime();
+}
+
+// The ThinLTO summary of the bitcode in Buffer, or else the one in its
+// sidecar file if it is not older than the input; nullptr if there is none.
+static Expected<std::unique_ptr<ModuleSummaryIndex>>
+loadSummary(StringRef Path, MemoryBufferRef Buffer) {
+  Expected<BitcodeLTOInfo> Info = getBitcodeLTOInfo(Buffer);
+  if (Info && Info->HasSummary)
+    return getModuleSummaryIndex(Buffer);
+  consumeError(Info.takeError());
+
+  if (!isSidecarFresh(Path, SummarySuffix))
+    return nullptr;
+  return getModuleSummaryIndexForFile((Path + SummarySuffix).str());
+}
+
+static void writeSummary(StringRef Path, const Module &M) {
+  ProfileSummaryInfo PSI(M);
+  ModuleSummaryIndex Index = buildModuleSummaryIndex(M, nullptr, &PSI);
+  std::string SummaryPath = (Path + SummarySuffix).str();
+  std::error_code EC;
+  raw_fd_ostream Out(SummaryPath, EC, sys::fs::OF_None);
+  if (!EC) {
+    writeIndexToFile(Index, Out);
+    Out.close();
+    EC = Out.error();
+  }
+  if (EC)
+    reportError(SummaryPath + ": " + EC.message());
+}
+
+// The MMIO functions of Path found by a previous run, or nullptr if they
+// are unknown or may have changed since. The first line of the file is the
+// ResultVersion that wrote it.
+static std::unique_ptr<DenseSet<GlobalValue::GUID>>
+loadCandidates(StringRef Path) {
+  if (!isSidecarFresh(Path, CandidatesSuffix))
+    return nullptr;
+  auto Buffer = MemoryBuffer::getFile(Path + CandidatesSuffix);
+  if (!Buffer)
+    return nullptr;
+  SmallVector<StringRef, 0> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+  unsigned Version;
+  if (Lines.empty() || Lines[0].getAsInteger(10, Version) ||
+      Version != FindHALBypass::ResultVersion)
+    return nullptr;
+  auto Candidates = std::make_unique<DenseSet<GlobalValue::GUID>>();
+  for (StringRef Line : makeArrayRef(Lines).drop_front()) {
+    GlobalValue::GUID GUID;
+    if (Line.getAsInteger(10, GUID))
+      return nullptr;
+    Candidates->insert(GUID);
+  }
+  return Candidates;
+}
+
+static void writeCandidates(StringRef Path, const FindHALBypass::Result &Res) {
+  std::string Contents;
+  raw_string_ostream OS(Contents);
+  OS << FindHALBypass::ResultVersion << "\n";
+  for (auto &Node : Res)
+    OS << Node.first->getGUID() << "\n";
+  OS.flush();
+  writeFile((Path + CandidatesSuffix).str(), Contents);
+}
+
+static bool analyzeFile(const std::string &Path) {
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer) {
+    reportError(Path + ": " + Buffer.getError().message());
+    return false;
+  }
+  std::string CachePath, Report;
+  if (!CacheDir.empty()) {
+    CachePath = getCachePath((*Buffer)->getBuffer());
+    if (readCache(CachePath, Report))
+      return writeFile(Path + OutSuffix, Report);
+  }
+
+  std::unique_ptr<ModuleSummaryIndex> Index;
+  std::unique_ptr<DenseSet<GlobalValue::GUID>> Candidates;
+  if (SummaryCallGraph) {
+    Expected<std::unique_ptr<ModuleSummaryIndex>> I =
+        loadSummary(Path, (*Buffer)->getMemBufferRef());
+    if (!I) {
+      reportError(Path + ": " + toString(I.takeError()));
+      return false;
+    }
+    Index = std::move(*I);
+    Candidates = loadCandidates(Path);
+  }
+
+  // Without a summary yet, the module is read in full once to build it.
+  // As for a unit, the context only lives as long as the module.
+  bool Lazy = LazyLoad || Index;
+  LLVMContext Ctx;
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M =
+      Lazy ? getLazyIRModule(std::move(*Buffer), Diag, Ctx,
+                             /*ShouldLazyLoadMetadata=*/true)
+           : parseIR(**Buffer, Diag, Ctx);
+  if (!M) {
+    reportError(Path + ": " + Diag.getMessage());
+    return false;
+  }
+  raw_string_ostream OS(Report);
+  if (Lazy) {
+    FindHALBypass HALBypass;
+    FindHALBypass::Result Res;
+    if (Error E = HALBypass.runOnLazyModule(*M, Res, Index.get(),
+                                            Candidates.get())) {
+      reportError(Path + ": " + toString(std::move(E)));
+      return false;
+    }
+    FindHALBypassPrinter(OS, ReportFormat).print(Res);
+    if (Index && !Candidates)
+      writeCandidates(Path, Res);
+  } else {
+    if (SummaryCallGraph)
+      writeSummary(Path, *M);
+    ModuleAnalysisManager MAM;
+    MAM.registerPass([] { return PassInstrumentationAnalysis(); });
+    MAM.registerPass([] { return FindMMIOFunc(); });
+    MAM.registerPass([] { return FindHALBypass(); });
+    FindHALBypassPrinter(OS, ReportFormat).run(*M, MAM);
+    if (SummaryCallGraph)
+      writeCandidates(Path, *MAM.getCachedResult<FindHALBypass>(*M));
+  }
+  OS.flush();
+
+  if (!CachePath.empty())
+    writeCache(CachePath, Report);
+  return writeFile(Path + OutSuffix, Report);
+}
+
+// Adds the unit in Path, the input at Position, to Union.
+static bool analyzeUnit(const std::string &Path, unsigned Position,
+                        UnionCallGraph &Union) {
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer) {
+    reportError(Path + ": " + Buffer.getError().message());
+    return false;
+  }
+  std::unique_ptr<ModuleSummaryIndex> Index;
+  std::unique_ptr<DenseSet<GlobalValue::GUID>> Candidates;
+  if (SummaryCallGraph) {
+    Expected<std::unique_ptr<ModuleSummaryIndex>> I =
+        loadSummary(Path, (*Buffer)->getMemBufferRef());
+    if (!I) {
+      reportError(Path + ": " + toString(I.takeError()));
+      return false;
+    }
+    Index = std::move(*I);
+    Candidates = loadCandidates(Path);
+  }
+
+  // Uniqued constants and metadata live as long as their context: one
+  // context per unit keeps them from piling up over the run.
+  LLVMContext Ctx;
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M = getLazyIRModule(
+      std::move(*Buffer), Diag, Ctx, /*ShouldLazyLoadMetadata=*/true);
+  if (!M) {
+    reportError(Path + ": " + Diag.getMessage());
+    return false;
+  }
+  if (Error E =
+          Union.addUnit(Position, *M, Index.get(), Candidates.get())) {
+    reportError(Path + ": " + toString(std::move(E)));
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  // Files are already analyzed in parallel; by default, each analysis runs
+  // on its worker thread only.
+  MMIOScanThreads.setInitialValue(1);
+  TCEstThreads.setInitialValue(1);
+  // The timing lines of concurrent analyses would interleave on stderr.
+  HalAnalysisTime.setInitialValue(false);
+  cl::ParseCommandLineOptions(argc, argv, "HAL bypass batch analyzer\n");
+
+  std::multimap<uint64_t, InputFile> Files;
+  bool InputsOK = true;
+  for (const std::string &Input : Inputs)
+    InputsOK &= addInput(Input, Files);
+  if (!FileList.empty()) {
+    auto Buffer = MemoryBuffer::getFile(FileList);
+    if (!Buffer) {
+      reportError(FileList + ": " + Buffer.getError().message());
+      return 1;
+    }
+    SmallVector<StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    for (StringRef Line : Lines)
+      if (!Line.trim().empty())
+        InputsOK &= addInput(Line.trim(), Files);
+  }
+  if (Files.empty()) {
+    reportError("no input files");
+    return 1;
+  }
+  if (SummaryCallGraph && FlatCallGraph::resolvesIndirectCalls()) {
+    reportError("-hal-indirect-calls needs the function bodies; it cannot "
+                "be used with -summary-callgraph");
+    return 1;
+  }
+  // A missing unit would silently lower the in-degrees.
+  if (!WholeProgram.empty() && !InputsOK)
+    return 1;
+  // The snapshot goes to a single file, and is only written by an analysis
+  // (not for a cached report nor for the union call graph).
+  StringMap<cl::Option *> &Opts = cl::getRegisteredOptions();
+  if (cl::Option *O = Opts.lookup("hal-snapshot"))
+    if (O->getNumOccurrences() &&
+        (Files.size() > 1 || !CacheDir.empty() || !WholeProgram.empty())) {
+      reportError("-hal-snapshot needs a single input file, without "
+                  "-cache-dir and -whole-program");
+      return 1;
+    }
+  // Likewise for the directory rollup, which the union call graph writes.
+  if (cl::Option *O = Opts.lookup("hal-dir-rollup"))
+    if (O->getNumOccurrences() && WholeProgram.empty() &&
+        (Files.size() > 1 || !CacheDir.empty())) {
+      reportError("-hal-dir-rollup needs a single input file without "
+                  "-cache-dir, or -whole-program");
+      return 1;
+    }
+
+  // Whole-program reports depend on every unit: they are not cached.
+  Optional<CachePruningPolicy> Policy;
+  if (!CacheDir.empty() && WholeProgram.empty()) {
+    Expected<CachePruningPolicy> P = parseCachePruningPolicy(CachePolicy);
+    if (!P) {
+      reportError("-cache-policy: " + toString(P.takeError()));
+      return 1;
+    }
+    if (std::error_code EC = sys::fs::create_directories(CacheDir)) {
+      reportError(CacheDir + ": " + EC.message());
+      return 1;
+    }
+    Policy = *P;
+    ConfigKey = FindHALBypass::getConfigKey();
+  }
+
+  size_t NumFiles = Files.size();
+  Scheduler Sched(std::move(Files), uint64_t(MemBudgetMiB) << 20);
+  std::atomic<unsigned> NumFailed(0);
+  std::unique_ptr<UnionCallGraph> Union;
+  if (!WholeProgram.empty())
+    Union = std::make_unique<UnionCallGraph>();
+  ThreadPool Pool(hardware_concurrency(NumThreads));
+  unsigned NumWorkers =
+      std::min<size_t>(Pool.getThreadCount(), NumFiles);
+  for (unsigned W = 0; W < NumWorkers; W++)
+    Pool.async([&Sched, &NumFailed, &Union] {
+      InputFile File;
+      uint64_t Cost;
+      while (Sched.take(File, Cost)) {
+        if (!(Union ? analyzeUnit(File.Path, File.Position, *Union)
+                    : analyzeFile(File.Path)))
+          NumFailed++;
+        Sched.release(Cost);
+      }
+    });
+  Pool.wait();
+  if (Policy)
+    pruneCache(CacheDir, *Policy);
+
+  if (Union && !NumFailed) {
+    std::string Report;
+    raw_string_ostream OS(Report);
+    FindHALBypassPrinter(OS, ReportFormat).print(Union->computeReport());
+    OS.flush();
+    if (!writeFile(WholeProgram, Report))
+      return 1;
+  }
+
+  if (NumFailed) {
+    reportError(Twine(NumFailed.load()) + " of " + Twine(NumFiles) +
+                " files failed");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+//==============================================================================
+// FILE:
+//    MMIOSiteTable.cpp
+//
+// DESCRIPTION:
+//    Structure-of-arrays table of the MMIO instructions of a module (see
+//    MMIOSiteTable.h).
+//
+// License: MIT
+//==============================================================================
+#include "MMIOSiteTable.h"
+#include "FindMMIOFunc.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instructions.h"
+#include <algorithm>
+
+using namespace llvm;
+
+MMIOSiteTable::MMIOSiteTable(ArrayRef<const Instruction *> Sites,
+                             ArrayRef<uint32_t> SiteFuncs)
+    : NumSites(Sites.size()) {
+  size_t N = NumSites;
+  Storage.reset(new char[N * (sizeof(uint64_t) + 2 * sizeof(uint32_t) +
+                              sizeof(uint16_t) + 2 * sizeof(uint8_t))]);
+  Addresses = reinterpret_cast<uint64_t *>(Storage.get());
+  LocIDs = reinterpret_cast<uint32_t *>(Addresses + N);
+  Funcs = LocIDs + N;
+  Widths = reinterpret_cast<uint16_t *>(Funcs + N);
+  Kinds = reinterpret_cast<uint8_t *>(Widths + N);
+  HasAddrs = Kinds + N;
+
+  DenseMap<const DILocation *, uint32_t> LocIDOf;
+  for (size_t I = 0; I < N; I++) {
+    const Instruction &Ins = *Sites[I];
+    const DataLayout &DL = Ins.getModule()->getDataLayout();
+    Optional<uint64_t> Addr = FindMMIOFunc::getMMIOAddress(Ins);
+    Addresses[I] = Addr.getValueOr(0);
+    HasAddrs[I] = Addr.hasValue();
+    Funcs[I] = SiteFuncs[I];
+    Type *Accessed = nullptr;
+    if (auto *LI = dyn_cast<LoadInst>(&Ins)) {
+      Kinds[I] = Load;
+      Accessed = LI->getType();
+    } else if (auto *SI = dyn_cast<StoreInst>(&Ins)) {
+      Kinds[I] = Store;
+      Accessed = SI->getValueOperand()->getType();
+    } else {
+      Kinds[I] = GEP;
+    }
+    Widths[I] = Accessed ? std::min<uint64_t>(DL.getTypeStoreSize(Accessed),
+                                              UINT16_MAX)
+                         : 0;
+    const DILocation *Loc = Ins.getDebugLoc().get();
+    if (!Loc) {
+      LocIDs[I] = 0;
+      continue;
+    }
+    auto It = LocIDOf.insert({Loc, static_cast<uint32_t>(Locs.size())}).first;
+    if (It->second == Locs.size())
+      Locs.push_back(Loc);
+    LocIDs[I] = It->second;
+  }
+}
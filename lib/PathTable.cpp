@@ -0,0 +1,109 @@
+//==============================================================================
+// FILE:
+//    PathTable.cpp
+//
+// DESCRIPTION:
+//    Per-module table of interned source paths.
+//
+// License: MIT
+//==============================================================================
+#include "PathTable.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include <algorithm>
+
+using namespace llvm;
+
+static std::string resolvePath(StringRef Dir, StringRef Filename,
+                               StringRef CWD);
+
+//------------------------------------------------------------------------------
+// PathTable Implementation
+//------------------------------------------------------------------------------
+PathTable::PathTable() : Saver(Alloc) {
+  SmallString<256> Dir;
+  if (!sys::fs::current_path(Dir))
+    CWD = std::string(Dir);
+}
+
+unsigned PathTable::getFileID(const DIFile *File) {
+  auto It = FileIDs.find(File);
+  if (It != FileIDs.end())
+    return It->second;
+  StringRef Dir = File ? File->getDirectory() : "";
+  StringRef Filename = File ? File->getFilename() : "";
+  unsigned ID = intern(resolvePath(Dir, Filename, CWD));
+  FileIDs[File] = ID;
+  return ID;
+}
+
+unsigned PathTable::getDirID(unsigned ID) {
+  if (DirIDs[ID] == -1) {
+    // "" stays reserved for no directory: a file in "/" is in "/", and a
+    // bare file name in ".".
+    StringRef Path = Paths[ID];
+    size_t Sep = Path.find_last_of("/\\");
+    StringRef Dir = Sep == StringRef::npos
+                        ? StringRef(".")
+                        : Path.substr(0, std::max<size_t>(Sep, 1));
+    DirIDs[ID] = intern(Dir);
+  }
+  return DirIDs[ID];
+}
+
+unsigned PathTable::intern(StringRef Path) {
+  auto It = IDs.find(Path);
+  if (It != IDs.end())
+    return It->second;
+  unsigned ID = static_cast<unsigned>(Paths.size());
+  StringRef Saved = Saver.save(Path);
+  IDs[Saved] = ID;
+  Paths.push_back(Saved);
+  DirIDs.push_back(-1);
+  return ID;
+}
+
+//------------------------------------------------------------------------------
+// Helper functions
+//------------------------------------------------------------------------------
+// Normalizes Dir + "/" + Filename without resolving symbolic links: a
+// relative path is made absolute against CWD, and empty and "." components
+// are dropped, as is ".." with the component before it.
+static std::string resolvePath(StringRef Dir, StringRef Filename,
+                               StringRef CWD) {
+  SmallString<256> FullPath(Dir);
+  FullPath += "/";
+  FullPath += Filename;
+  // Not sys::path::is_absolute, which takes a leading "//" for a network
+  // root name.
+  if (FullPath[0] != '/') {
+    if (CWD.empty())
+      return std::string(FullPath);
+    FullPath.insert(FullPath.begin(), '/');
+    FullPath.insert(FullPath.begin(), CWD.begin(), CWD.end());
+  }
+
+  SmallVector<StringRef, 16> Components;
+  SmallVector<StringRef, 16> Parts;
+  StringRef(FullPath).split(Parts, '/');
+  for (StringRef Part : Parts) {
+    if (Part.empty() || Part == ".")
+      continue;
+    if (Part == "..") {
+      if (!Components.empty())
+        Components.pop_back();
+      continue;
+    }
+    Components.push_back(Part);
+  }
+  if (Components.empty())
+    return "/";
+  SmallString<256> Resolved;
+  for (StringRef Component : Components) {
+    Resolved += "/";
+    Resolved += Component;
+  }
+  return std::string(Resolved);
+}
@@ -0,0 +1,499 @@
+//==============================================================================
+// FILE:
+//    PeripheralIndex.cpp
+//
+// DESCRIPTION:
+//    Peripheral and register address ranges read from CMSIS-SVD files. The
+//    files are read in one pass with a pull reader over the XML tokens; only
+//    the current peripheral, its clusters and register are kept while
+//    reading.
+//
+// License: MIT
+//==============================================================================
+#include "PeripheralIndex.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+#include <map>
+
+using namespace llvm;
+
+static cl::list<std::string>
+    HalSVDFiles("hal-svd",
+                cl::desc("CMSIS-SVD files describing the peripherals of the "
+                         "device (comma-separated)"),
+                cl::value_desc("filename"), cl::CommaSeparated);
+
+//------------------------------------------------------------------------------
+// Intervals Implementation
+//------------------------------------------------------------------------------
+void PeripheralIndex::Intervals::add(uint64_t Start, uint64_t End, int ID) {
+  if (Start < End)
+    Added.push_back({Start, {End, ID}});
+}
+
+// Each interval only gets the parts not covered by those added before it.
+void PeripheralIndex::Intervals::finalize() {
+  std::map<uint64_t, Span> Map;
+  for (auto &I : Added) {
+    uint64_t Cur = I.first, End = I.second.End;
+    auto It = Map.upper_bound(Cur);
+    if (It != Map.begin() && std::prev(It)->second.End > Cur)
+      Cur = std::prev(It)->second.End;
+    while (Cur < End) {
+      It = Map.lower_bound(Cur);
+      if (It != Map.end() && It->first == Cur) {
+        Cur = It->second.End;
+        continue;
+      }
+      uint64_t Next = It == Map.end() ? End : std::min(End, It->first);
+      Map.emplace_hint(It, Cur, Span{Next, I.second.ID});
+      Cur = Next;
+    }
+  }
+  Added.clear();
+  Starts.clear();
+  Spans.clear();
+  for (auto &I : Map) {
+    Starts.push_back(I.first);
+    Spans.push_back(I.second);
+  }
+}
+
+int PeripheralIndex::Intervals::lookup(uint64_t Addr) const {
+  auto It = std::upper_bound(Starts.begin(), Starts.end(), Addr);
+  if (It == Starts.begin())
+    return -1;
+  const Span &S = Spans[It - Starts.begin() - 1];
+  return Addr < S.End ? S.ID : -1;
+}
+
+//------------------------------------------------------------------------------
+// SVD reader
+//------------------------------------------------------------------------------
+namespace {
+// Pull reader of the XML that SVD files use: elements, attributes and text;
+// comments, declarations and processing instructions are skipped. Entities
+// are not decoded, which only matters for descriptions.
+class XMLReader {
+public:
+  enum Token { StartTag, EndTag, Text, End, Error };
+
+  explicit XMLReader(StringRef Buffer) : Buffer(Buffer), Pos(0) {}
+
+  Token next();
+  // Element name of a StartTag or EndTag, trimmed text of a Text.
+  StringRef Value;
+  // Attributes of a StartTag.
+  SmallVector<std::pair<StringRef, StringRef>, 2> Attrs;
+
+  unsigned getLine() const { return Buffer.take_front(Pos).count('\n') + 1; }
+
+private:
+  StringRef Buffer;
+  size_t Pos;
+  // Name of an empty-element tag, whose EndTag comes next.
+  StringRef PendingEnd;
+};
+
+XMLReader::Token XMLReader::next() {
+  if (!PendingEnd.empty()) {
+    Value = PendingEnd;
+    PendingEnd = StringRef();
+    return EndTag;
+  }
+  while (Pos < Buffer.size()) {
+    if (Buffer[Pos] != '<') {
+      size_t Lt = Buffer.find('<', Pos);
+      StringRef Chars = Buffer.slice(Pos, Lt).trim();
+      Pos = Lt;
+      if (Chars.empty())
+        continue;
+      Value = Chars;
+      return Text;
+    }
+    StringRef Rest = Buffer.drop_front(Pos);
+    StringRef Terminator = Rest.startswith("<!--")   ? "-->"
+                           : Rest.startswith("<?")   ? "?>"
+                           : Rest.startswith("<!")   ? ">"
+                                                     : "";
+    if (!Terminator.empty()) {
+      size_t Close = Buffer.find(Terminator, Pos);
+      if (Close == StringRef::npos)
+        return Error;
+      Pos = Close + Terminator.size();
+      continue;
+    }
+    size_t Close = Buffer.find('>', Pos);
+    if (Close == StringRef::npos)
+      return Error;
+    StringRef Tag = Buffer.slice(Pos + 1, Close);
+    Pos = Close + 1;
+    if (Tag.consume_front("/")) {
+      Value = Tag.trim();
+      return EndTag;
+    }
+    bool Empty = Tag.consume_back("/");
+    size_t NameEnd = Tag.find_first_of(" \t\r\n");
+    Value = Tag.take_front(NameEnd);
+    Tag = Tag.drop_front(Value.size()).trim();
+    Attrs.clear();
+    while (!Tag.empty()) {
+      StringRef Name, Rest;
+      std::tie(Name, Rest) = Tag.split('=');
+      Rest = Rest.ltrim();
+      if (Rest.empty() || (Rest[0] != '"' && Rest[0] != '\''))
+        return Error;
+      size_t Quote = Rest.find(Rest[0], 1);
+      if (Quote == StringRef::npos)
+        return Error;
+      Attrs.push_back({Name.trim(), Rest.slice(1, Quote)});
+      Tag = Rest.drop_front(Quote + 1).ltrim();
+    }
+    if (Empty)
+      PendingEnd = Value;
+    return StartTag;
+  }
+  return End;
+}
+
+// scaledNonNegativeInteger of the SVD schema: decimal, 0x hexadecimal or
+// #binary, with an optional k, M or G multiplier.
+bool parseNumber(StringRef S, uint64_t &V) {
+  uint64_t Scale = 1;
+  if (S.consume_back("k") || S.consume_back("K"))
+    Scale = 1ULL << 10;
+  else if (S.consume_back("M"))
+    Scale = 1ULL << 20;
+  else if (S.consume_back("G"))
+    Scale = 1ULL << 30;
+  bool Failed;
+  if (S.consume_front("0x") || S.consume_front("0X"))
+    Failed = S.getAsInteger(16, V);
+  else if (S.consume_front("#"))
+    Failed = S.getAsInteger(2, V);
+  else
+    Failed = S.getAsInteger(10, V);
+  V *= Scale;
+  return !Failed;
+}
+
+struct SVDRegister {
+  std::string Name;
+  uint64_t Offset = 0;
+  // In bits.
+  uint64_t Size = 32;
+};
+
+// A peripheral, or a cluster of registers within one, as it is read.
+struct SVDGroup {
+  std::string Name;
+  std::string DerivedFrom;
+  // Base address of a peripheral, address offset of a cluster.
+  uint64_t Address = 0;
+  // Default register size, in bits.
+  uint64_t Size = 32;
+  uint64_t Dim = 0, DimIncrement = 0;
+  std::string DimIndex;
+  // Address blocks of a peripheral, as (offset, size).
+  std::vector<std::pair<uint64_t, uint64_t>> Blocks;
+  std::vector<SVDRegister> Registers;
+};
+
+// The names of the elements of a dim array: dimIndex is a comma-separated
+// list or a range, like "0-3" or "A-D"; without it, 0 to Dim - 1.
+std::vector<std::string> getDimNames(StringRef Name, uint64_t Dim,
+                                     StringRef DimIndex) {
+  std::vector<std::string> Indices;
+  StringRef First, Last;
+  std::tie(First, Last) = DimIndex.split('-');
+  unsigned A, B;
+  if (DimIndex.contains(',')) {
+    SmallVector<StringRef, 8> Parts;
+    DimIndex.split(Parts, ',');
+    for (StringRef P : Parts)
+      Indices.push_back(P.trim().str());
+  } else if (!First.getAsInteger(10, A) && !Last.getAsInteger(10, B)) {
+    for (uint64_t I = A; I <= B && Indices.size() < Dim; I++)
+      Indices.push_back(std::to_string(I));
+  } else if (First.size() == 1 && Last.size() == 1) {
+    for (int C = First[0]; C <= Last[0]; C++)
+      Indices.push_back(std::string(1, static_cast<char>(C)));
+  } else {
+    for (uint64_t I = 0; I < Dim; I++)
+      Indices.push_back(std::to_string(I));
+  }
+  Indices.resize(std::min<uint64_t>(Indices.size(), Dim));
+
+  std::vector<std::string> Names;
+  size_t Placeholder = Name.find("%s");
+  for (const std::string &Index : Indices) {
+    std::string N = Name.str();
+    if (Placeholder != StringRef::npos)
+      N.replace(Placeholder, 2, Index);
+    else
+      N += Index;
+    Names.push_back(N);
+  }
+  return Names;
+}
+
+// Adds R to Into, each of its elements if it is an array.
+void addRegister(SVDGroup &Into, SVDRegister R, uint64_t Dim,
+                 uint64_t DimIncrement, StringRef DimIndex) {
+  if (!Dim) {
+    Into.Registers.push_back(std::move(R));
+    return;
+  }
+  std::vector<std::string> Names = getDimNames(R.Name, Dim, DimIndex);
+  for (size_t I = 0; I < Names.size(); I++)
+    Into.Registers.push_back({Names[I], R.Offset + I * DimIncrement, R.Size});
+}
+
+// Adds the registers of cluster C to Into, prefixed by the cluster name.
+void addCluster(SVDGroup &Into, const SVDGroup &C) {
+  std::vector<std::string> Names =
+      C.Dim ? getDimNames(C.Name, C.Dim, C.DimIndex)
+            : std::vector<std::string>{C.Name};
+  for (size_t I = 0; I < Names.size(); I++)
+    for (const SVDRegister &R : C.Registers)
+      Into.Registers.push_back({Names[I] + "." + R.Name,
+                                C.Address + I * C.DimIncrement + R.Offset,
+                                R.Size});
+}
+} // namespace
+
+//------------------------------------------------------------------------------
+// PeripheralIndex Implementation
+//------------------------------------------------------------------------------
+const PeripheralIndex *PeripheralIndex::get() {
+  static const PeripheralIndex *Index = []() -> const PeripheralIndex * {
+    if (HalSVDFiles.empty())
+      return nullptr;
+    static PeripheralIndex I;
+    for (const std::string &File : HalSVDFiles) {
+      auto Buffer = MemoryBuffer::getFile(File);
+      if (!Buffer)
+        report_fatal_error(Twine("cannot read ") + File + ": " +
+                               Buffer.getError().message(),
+                           false);
+      std::string Err;
+      if (!I.parse((*Buffer)->getBuffer(), Err))
+        report_fatal_error(Twine(File) + ": " + Err, false);
+    }
+    I.finalize();
+    return &I;
+  }();
+  return Index;
+}
+
+bool PeripheralIndex::parse(StringRef Buffer, std::string &Err) {
+  XMLReader R(Buffer);
+  // Open elements, innermost last.
+  SmallVector<StringRef, 16> Elements;
+  // The peripheral being read, then its open clusters.
+  std::vector<SVDGroup> Groups;
+  SVDRegister Reg;
+  uint64_t RegDim = 0, RegDimIncrement = 0;
+  std::string RegDimIndex;
+  std::pair<uint64_t, uint64_t> Block;
+  uint64_t DeviceSize = 32;
+  std::vector<SVDGroup> Read;
+
+  auto Fail = [&](const Twine &Msg) {
+    Err = ("line " + Twine(R.getLine()) + ": " + Msg).str();
+    return false;
+  };
+  for (;;) {
+    XMLReader::Token T = R.next();
+    if (T == XMLReader::End)
+      break;
+    if (T == XMLReader::Error)
+      return Fail("malformed XML");
+
+    if (T == XMLReader::StartTag) {
+      StringRef Parent = Elements.empty() ? "" : Elements.back();
+      Elements.push_back(R.Value);
+      if (R.Value == "peripheral" && Parent == "peripherals") {
+        Groups.assign(1, SVDGroup());
+        Groups[0].Size = DeviceSize;
+        for (auto &A : R.Attrs)
+          if (A.first == "derivedFrom")
+            Groups[0].DerivedFrom = A.second.str();
+      } else if (Groups.empty()) {
+        continue;
+      } else if (R.Value == "cluster") {
+        SVDGroup C;
+        C.Size = Groups.back().Size;
+        Groups.push_back(std::move(C));
+      } else if (R.Value == "register") {
+        Reg = SVDRegister();
+        Reg.Size = Groups.back().Size;
+        RegDim = RegDimIncrement = 0;
+        RegDimIndex.clear();
+      } else if (R.Value == "addressBlock") {
+        Block = {0, 0};
+      }
+      continue;
+    }
+
+    if (T == XMLReader::EndTag) {
+      if (Elements.empty() || Elements.back() != R.Value)
+        return Fail("unexpected </" + R.Value + ">");
+      Elements.pop_back();
+      StringRef Parent = Elements.empty() ? "" : Elements.back();
+      if (Groups.empty())
+        continue;
+      if (R.Value == "register") {
+        addRegister(Groups.back(), std::move(Reg), RegDim, RegDimIncrement,
+                    RegDimIndex);
+      } else if (R.Value == "cluster" && Groups.size() > 1) {
+        SVDGroup C = std::move(Groups.back());
+        Groups.pop_back();
+        addCluster(Groups.back(), C);
+      } else if (R.Value == "addressBlock") {
+        Groups[0].Blocks.push_back(Block);
+      } else if (R.Value == "peripheral" && Parent == "peripherals") {
+        Read.push_back(std::move(Groups[0]));
+        Groups.clear();
+      }
+      continue;
+    }
+
+    // Text: only that of the fields of a device, peripheral, cluster,
+    // register or address block is used.
+    if (Elements.size() < 2)
+      continue;
+    StringRef Field = Elements.back();
+    StringRef Owner = Elements[Elements.size() - 2];
+    bool IsName = Field == "name";
+    uint64_t V = 0;
+    if ((Owner == "device" || Owner == "peripheral" || Owner == "cluster" ||
+         Owner == "register" || Owner == "addressBlock") &&
+        (Field == "size" || Field == "baseAddress" ||
+         Field == "addressOffset" || Field == "offset" || Field == "dim" ||
+         Field == "dimIncrement") &&
+        !parseNumber(R.Value, V))
+      return Fail("invalid number '" + R.Value + "' in <" + Field + ">");
+
+    if (Owner == "device") {
+      if (Field == "size")
+        DeviceSize = V;
+    } else if (Groups.empty()) {
+      continue;
+    } else if (Owner == "register") {
+      if (IsName)
+        Reg.Name = R.Value.str();
+      else if (Field == "addressOffset")
+        Reg.Offset = V;
+      else if (Field == "size")
+        Reg.Size = V;
+      else if (Field == "dim")
+        RegDim = V;
+      else if (Field == "dimIncrement")
+        RegDimIncrement = V;
+      else if (Field == "dimIndex")
+        RegDimIndex = R.Value.str();
+    } else if (Owner == "addressBlock") {
+      if (Field == "offset")
+        Block.first = V;
+      else if (Field == "size")
+        Block.second = V;
+    } else if (Owner == "peripheral" || Owner == "cluster") {
+      SVDGroup &G = Groups.back();
+      if (IsName)
+        G.Name = R.Value.str();
+      else if (Field == "baseAddress" || Field == "addressOffset")
+        G.Address = V;
+      else if (Field == "size")
+        G.Size = V;
+      else if (Field == "dim")
+        G.Dim = V;
+      else if (Field == "dimIncrement")
+        G.DimIncrement = V;
+      else if (Field == "dimIndex")
+        G.DimIndex = R.Value.str();
+    }
+  }
+  if (!Elements.empty())
+    return Fail("unclosed <" + Elements.back() + ">");
+
+  // A derived peripheral has the address blocks and registers of its base,
+  // unless it has its own. The base may be derived itself, and appear later
+  // in the file, so each chain of bases is followed to a peripheral that is
+  // not derived, or already resolved, and resolved from there down.
+  StringMap<size_t> ByName;
+  for (size_t I = 0; I < Read.size(); I++)
+    ByName.try_emplace(Read[I].Name, I);
+  enum : uint8_t { Unresolved, Resolving, Resolved };
+  std::vector<uint8_t> State(Read.size(), Unresolved);
+  std::vector<std::pair<size_t, size_t>> Chain;
+  for (size_t I = 0; I < Read.size(); I++) {
+    size_t P = I;
+    Chain.clear();
+    while (State[P] == Unresolved && !Read[P].DerivedFrom.empty()) {
+      State[P] = Resolving;
+      auto It = ByName.find(Read[P].DerivedFrom);
+      if (It == ByName.end()) {
+        Err = "peripheral " + Read[P].Name + " derived from unknown " +
+              Read[P].DerivedFrom;
+        return false;
+      }
+      Chain.push_back({P, It->second});
+      P = It->second;
+    }
+    if (State[P] == Resolving) {
+      Err = "peripheral " + Read[P].Name + " is in a cycle of derivedFrom";
+      return false;
+    }
+    State[P] = Resolved;
+    for (auto &Link : reverse(Chain)) {
+      SVDGroup &Derived = Read[Link.first];
+      const SVDGroup &Base = Read[Link.second];
+      if (Derived.Blocks.empty())
+        Derived.Blocks = Base.Blocks;
+      if (Derived.Registers.empty())
+        Derived.Registers = Base.Registers;
+      State[Link.first] = Resolved;
+    }
+  }
+
+  for (const SVDGroup &P : Read) {
+    int ID = static_cast<int>(Peripherals.size());
+    Peripherals.push_back({P.Name, P.Address});
+    // Without address blocks, the peripheral spans its registers.
+    uint64_t Lo = UINT64_MAX, Hi = 0;
+    for (const SVDRegister &Reg : P.Registers) {
+      uint64_t Start = P.Address + Reg.Offset;
+      uint64_t End = Start + std::max<uint64_t>(Reg.Size / 8, 1);
+      RegisterRanges.add(Start, End, static_cast<int>(RegisterNames.size()));
+      RegisterNames.push_back(Reg.Name);
+      Lo = std::min(Lo, Start);
+      Hi = std::max(Hi, End);
+    }
+    for (auto &B : P.Blocks)
+      PeripheralRanges.add(P.Address + B.first, P.Address + B.first + B.second,
+                           ID);
+    if (P.Blocks.empty())
+      PeripheralRanges.add(Lo, Hi, ID);
+  }
+  Hash = Hash * 0x9E3779B97F4A7C15ULL + xxHash64(Buffer);
+  return true;
+}
+
+void PeripheralIndex::finalize() {
+  PeripheralRanges.finalize();
+  RegisterRanges.finalize();
+}
+
+PeripheralIndex::Match PeripheralIndex::lookup(uint64_t Addr) const {
+  Match M;
+  M.Peripheral = PeripheralRanges.lookup(Addr);
+  M.Register = RegisterRanges.lookup(Addr);
+  return M;
+}
@@ -0,0 +1,168 @@
+//==============================================================================
+// FILE:
+//    UnionCallGraph.cpp
+//
+// DESCRIPTION:
+//    Call graph of a program made of many bitcode units, streamed one unit
+//    at a time. Node 0 and 1 stand for the external calling node and the
+//    calls-external node of every unit's FlatCallGraph.
+//
+// License: MIT
+//==============================================================================
+#include "UnionCallGraph.h"
+
+#include "FlatCallGraph.h"
+
+#include "llvm/ADT/STLExtras.h"
+
+using namespace llvm;
+
+UnionCallGraph::UnionCallGraph() : NumNodes(2), Defined(2), Declared(2) {}
+
+int UnionCallGraph::getNode(StringRef Name, bool Local) {
+  if (!Local) {
+    auto Inserted = Symbols.insert({Name, NumNodes});
+    if (!Inserted.second)
+      return Inserted.first->second;
+  }
+  Defined.push_back(false);
+  Declared.push_back(false);
+  return NumNodes++;
+}
+
+Error UnionCallGraph::addUnit(unsigned UnitID, Module &M,
+                              const ModuleSummaryIndex *Index,
+                              const DenseSet<GlobalValue::GUID> *Candidates) {
+  FlatCallGraph CG(M);
+  // Bodies without MMIO instructions are deleted by the scan, so tell the
+  // definitions apart first.
+  Unit U;
+  U.Names.reserve(CG.numFuncs());
+  U.Kinds.reserve(CG.numFuncs());
+  U.Local.resize(CG.numFuncs());
+  for (int N = 0; N < CG.numFuncs(); N++) {
+    const Function *F = CG.getFunction(N);
+    U.Names.push_back(F->getName().str());
+    if (F->hasLocalLinkage())
+      U.Local.set(N);
+    if (F->isIntrinsic())
+      U.Kinds.push_back(FuncKind::Intrinsic);
+    else if (F->isDeclaration())
+      U.Kinds.push_back(FuncKind::Declaration);
+    else if (F->isWeakForLinker() || F->hasAvailableExternallyLinkage())
+      U.Kinds.push_back(FuncKind::Overridable);
+    else
+      U.Kinds.push_back(FuncKind::Definition);
+  }
+
+  FindMMIOFunc::Result UnitMMIOFuncs;
+  if (Error E = FindHALBypass::scanLazyModule(M, CG, UnitMMIOFuncs, Index,
+                                                Candidates))
+    return E;
+  for (const FlatCallGraph::Edge &E : CG.edges()) {
+    // The only edge of a declaration is to the calls-external node, which
+    // computeReport adds if no unit defines the function.
+    if (E.first < CG.numFuncs() && U.Kinds[E.first] <= FuncKind::Declaration)
+      continue;
+    U.Edges.push_back(E);
+  }
+
+  PathTable Paths;
+  for (auto &Node : UnitMMIOFuncs) {
+    FindHALBypass::MMIOFunc MF(Node.second, Node.first, Paths);
+    U.MMIOFuncs.push_back({CG.getNode(Node.first),
+                           MF.getReportEntry(Paths, *UnitMMIOFuncs.Sites),
+                           Paths.getPath(MF.DirID).str()});
+  }
+  // In function order rather than by address.
+  llvm::sort(U.MMIOFuncs,
+             [](const Unit::MMIOFunc &A, const Unit::MMIOFunc &B) {
+               return A.Func < B.Func;
+             });
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Units.emplace(UnitID, std::move(U));
+  return Error::success();
+}
+
+// Numbers the functions of the units in unit order, then keeps the edges
+// and MMIO functions of the body kept for each function (see FuncKind).
+void UnionCallGraph::merge() {
+  std::vector<std::vector<int>> UnitNodes;
+  // Per node: the unit of the body kept, and its kind.
+  std::vector<const Unit *> Body;
+  std::vector<FuncKind> BodyKind;
+  for (auto &I : Units) {
+    const Unit &U = I.second;
+    int NumFuncs = U.Names.size();
+    UnitNodes.emplace_back(NumFuncs + 2);
+    std::vector<int> &Nodes = UnitNodes.back();
+    for (int N = 0; N < NumFuncs; N++)
+      Nodes[N] = getNode(U.Names[N], U.Local.test(N));
+    Nodes[NumFuncs] = ExternalCallingNode;
+    Nodes[NumFuncs + 1] = CallsExternalNode;
+
+    Body.resize(NumNodes, nullptr);
+    BodyKind.resize(NumNodes, FuncKind::Intrinsic);
+    for (int N = 0; N < NumFuncs; N++) {
+      FuncKind Kind = U.Kinds[N];
+      if (Kind == FuncKind::Declaration)
+        Declared.set(Nodes[N]);
+      if (Kind <= FuncKind::Declaration)
+        continue;
+      Defined.set(Nodes[N]);
+      if (Kind > BodyKind[Nodes[N]]) {
+        Body[Nodes[N]] = &U;
+        BodyKind[Nodes[N]] = Kind;
+      }
+    }
+  }
+
+  size_t UnitIdx = 0;
+  for (auto &I : Units) {
+    Unit &U = I.second;
+    const std::vector<int> &Nodes = UnitNodes[UnitIdx++];
+    int NumFuncs = U.Names.size();
+    for (const CallGraphCSR::Edge &E : U.Edges)
+      if (E.first >= NumFuncs || Body[Nodes[E.first]] == &U)
+        Edges.push_back({Nodes[E.first], Nodes[E.second]});
+    for (Unit::MMIOFunc &MF : U.MMIOFuncs) {
+      int N = Nodes[MF.Func];
+      if (Body[N] == &U)
+        MMIOFuncs.insert({N, {std::move(MF.Entry), Dirs.insert(MF.Dir)}});
+    }
+  }
+  Units.clear();
+}
+
+std::vector<HALBypassReportEntry> UnionCallGraph::computeReport() {
+  merge();
+  for (int N = CallsExternalNode + 1; N < NumNodes; N++)
+    if (Declared.test(N) && !Defined.test(N))
+      Edges.push_back({N, CallsExternalNode});
+  CallGraphCSR G(NumNodes, std::move(Edges));
+  Edges.clear();
+
+  std::vector<int> Queries;
+  for (auto &I : MMIOFuncs)
+    Queries.push_back(I.first);
+  std::vector<int> InDegrees = FindHALBypass::computeTCInDegrees(G, Queries);
+
+  std::vector<FindHALBypass::DirRuleFunc> Funcs;
+  for (auto &I : MMIOFuncs) {
+    HALBypassReportEntry &Entry = I.second.Entry;
+    Entry.TransClosureInDeg = InDegrees[I.first];
+    Funcs.push_back(
+        {I.second.DirID, Entry.TransClosureInDeg, Entry.MacroUsed, false});
+  }
+  FindHALBypass::applyHalDirRule(Dirs, Funcs);
+  std::vector<HALBypassReportEntry> Report;
+  Report.reserve(MMIOFuncs.size());
+  size_t F = 0;
+  for (auto &I : MMIOFuncs) {
+    I.second.Entry.NCMA_CG = Funcs[F++].NCMA_CG;
+    Report.push_back(std::move(I.second.Entry));
+  }
+  MMIOFuncs.clear();
+  return Report;
+}
@@ -1,14 +1,13 @@
 #!/usr/bin/env bash
 
-LLVM_DIR="/usr/lib/llvm-14"
-
 #BITCODES=$(find "$RTOSExploration"/bitcode-db/nrf52-keyboard -name "*.bc")
 BITCODES=$(find "$RTOSExploration/bitcode-db/" \
   -not \( -path "$RTOSExploration/bitcode-db/esp-idf-examples" -prune \) -name "*.bc")
 BITCODES_ESP_IDF=$(find "$RTOSExploration/bitcode-db/esp-idf-examples" -name "*.ll")
-BITCODES="$BITCODES $BITCODES_ESP_IDF"
 
-parallel -i sh -c "${LLVM_DIR}/bin/opt \
-  -load-pass-plugin build/lib/libFindMMIOFunc.so \
-  -load-pass-plugin build/lib/libFindHALBypass.so \
-  --passes='print<hal-bypass>' --disable-output {} 2> {}.analysis" -- $BITCODES
+# Reports of unchanged files are reused from the cache; unused entries
+# expire after a week.
+HALVD_CACHE_DIR=${HALVD_CACHE_DIR:-"$RTOSExploration/.halvd-cache"}
+
+printf '%s\n' $BITCODES $BITCODES_ESP_IDF | build/bin/halvd \
+  -cache-dir="$HALVD_CACHE_DIR" -file-list=/dev/stdin